@@ -27,22 +27,87 @@
 
 #include "SPIFlash.h"
 
-SPIFlash::SPIFlash(uint8_t cspin)
+#define FLASH_STATS_NO_COUNT   (0xFFFFFFFFUL)
+#define FLASH_STATS_NO_LATENCY (0xFFFFFFFFUL)
+
+#define FLASH_POWER_STANDBY    (0)
+#define FLASH_POWER_DOWN       (1)  // DEEP POWER-DOWN sent
+#define FLASH_POWER_WAKING     (2)  // RELEASE from DEEP POWER-DOWN sent, tRES may not be over
+
+#ifdef ARDUINO
+SPIFlash::SPIFlash(uint8_t cspin, uint32_t clockHz) : _spi(cspin, clockHz)
 {
-  _cspin = cspin;
-  pinMode(_cspin, OUTPUT);
-  digitalWrite(_cspin, HIGH);  // CS pin is high when idle.
-  SPI.begin();
-  SPIset();
-  digitalWrite(_cspin, LOW);
-  SPI.transfer(SPI_WRITE_ENABLE);
-  digitalWrite(_cspin, HIGH);
+  _bus = &_spi;
+  flash_init();
 }
-void SPIFlash::SPIset()
+#endif
+/**
+   Drives the device through transport instead of the Arduino SPI library (see SPIFlashTransport.h).
+*/
+SPIFlash::SPIFlash(SPIFlashTransport &transport)
+#ifdef ARDUINO
+  : _spi(0xFF)
+#endif
 {
-  SPI.setBitOrder(MSBFIRST);
-  SPI.setDataMode(SPI_MODE0);
-  SPI.setClockDivider(SPI_CLOCK_DIV2);
+  _bus = &transport;
+  flash_init();
+}
+/**
+   Resets the driver state and initializes the transport; returns false if the transport failed to start.
+*/
+bool SPIFlash::flash_init(void)
+{
+  flash_cache_invalidate();
+  flash_cache_reset_stats();
+  flash_reset_stats();
+#if SPIFLASH_TRACE_LEN > 0
+  _trace_next = 0;
+  _trace_count = 0;
+#endif
+  _power = FLASH_POWER_STANDBY;
+  _power_at = 0;
+  _idle_us = 0;
+  _last_us = 0;
+  _stream_open = false;
+  _stream_addr = 0;
+  _map_sector = flash_SECTOR_COUNT;
+  _map_slot = 0;
+  _map_erased = 0;
+  _map_free = 0;
+  _map_stored_erased = 0;
+  _map_stored_free = 0;
+  _map_erasing = 0;
+  _erase_ahead = false;
+  _cycle_at = 0;
+  _cycle_us = 0;
+  if (!SPIset()) {
+    return false;
+  }
+  flash_write_enable();
+  return true;
+}
+/**
+   @brief SPI Settings.
+   @details
+   (Re)initializes the transport. With the Arduino SPI backend this configures the CS pin and prepares
+   the mode 0, MSB first settings at the clock given to the constructor (at most F_CPU / 2),
+   which every command applies with SPI.beginTransaction().
+   Returns false if the transport could not be started, e.g. a missing /dev/spidev node.
+*/
+bool SPIFlash::SPIset()
+{
+  _bus_ok = _bus->begin();
+  return _bus_ok;
+}
+/**
+   @brief Bus OK.
+   @details
+   Returns the result of the last SPIset(), including the one made by the constructor.
+   When it is false, commands go nowhere and reads return garbage.
+*/
+bool SPIFlash::flash_bus_ok(void)
+{
+  return _bus_ok;
 }
 /**
    @brief Write Enable.
@@ -53,9 +118,10 @@ void SPIFlash::SPIset()
 */
 void SPIFlash::flash_write_enable(void)
 {
-  SPI_ASSERT();
-  SPI.transfer(SPI_WRITE_ENABLE);
-  SPI_DEASSERT();
+  flash_xfer_t x;
+  flash_xfer_set(&x, SPI_WRITE_ENABLE, 0, 1);
+  flash_exec(&x, 1);
+  flash_trace(SPI_WRITE_ENABLE, 0, 0);
 }
 /**
    @brief Write Disable.
@@ -72,9 +138,10 @@ void SPIFlash::flash_write_enable(void)
 */
 void SPIFlash::flash_write_disable(void)
 {
-  SPI_ASSERT();
-  SPI.transfer(SPI_WRITE_DISABLE);
-  SPI_DEASSERT();
+  flash_xfer_t x;
+  flash_xfer_set(&x, SPI_WRITE_DISABLE, 0, 1);
+  flash_exec(&x, 1);
+  flash_trace(SPI_WRITE_DISABLE, 0, 0);
 }
 
 /**
@@ -92,17 +159,20 @@ void SPIFlash::flash_write_disable(void)
 
 void SPIFlash::flash_read_identification(struct flash_identification *p)
 {
-  int i;
-  SPI_ASSERT();
-  SPI.transfer(SPI_READ_IDENTIFICATION);
-  p->manufacturer = SPI.transfer(0);
-  p->memory_type = SPI.transfer(0);
-  p->memory_capacity = SPI.transfer(0);
-  p->cfd_length = SPI.transfer(0);
-  for (i = 0; i < p->cfd_length; i++) {
-    p->cfd_content[i] = SPI.transfer(0);
-  }
-  SPI_DEASSERT();
+  flash_xfer_t x;
+  uint8_t id[4 + sizeof(p->cfd_content)];
+  uint8_t n;
+  flash_xfer_set(&x, SPI_READ_IDENTIFICATION, 0, 1);
+  x.rx = id;
+  x.len = sizeof(id);
+  flash_exec(&x, 1);
+  p->manufacturer = id[0];
+  p->memory_type = id[1];
+  p->memory_capacity = id[2];
+  p->cfd_length = id[3];
+  n = (p->cfd_length < sizeof(p->cfd_content)) ? p->cfd_length : sizeof(p->cfd_content);
+  memcpy(p->cfd_content, &id[4], n);
+  flash_trace(SPI_READ_IDENTIFICATION, 0, sizeof(id));
 }
 
 /**
@@ -115,10 +185,11 @@ void SPIFlash::flash_read_identification(struct flash_identification *p)
 */
 void SPIFlash::flash_read_status_register(uint8_t *sreg)
 {
-  SPI_ASSERT();
-  SPI.transfer(SPI_READ_STATUS_REGISTER);
-  *sreg = SPI.transfer(0);
-  SPI_DEASSERT();
+  flash_xfer_t x;
+  flash_xfer_set(&x, SPI_READ_STATUS_REGISTER, 0, 1);
+  x.rx = sreg;
+  x.len = 1;
+  flash_exec(&x, 1);
 }
 
 /**
@@ -136,10 +207,13 @@ void SPIFlash::flash_read_status_register(uint8_t *sreg)
 */
 void SPIFlash::flash_write_status_register(uint8_t sreg)
 {
-  SPI_ASSERT();
-  SPI.transfer(SPI_WRITE_STATUS_REGISTER);
-  SPI.transfer(sreg);
-  SPI_DEASSERT();
+  flash_xfer_t x;
+  flash_xfer_set(&x, SPI_WRITE_STATUS_REGISTER, 0, 1);
+  x.tx = &sreg;
+  x.len = 1;
+  flash_exec(&x, 1);
+  flash_cycle_expect(flash_tW_US);
+  flash_trace(SPI_WRITE_STATUS_REGISTER, 0, 1);
 }
 /**
    @brief Read Data Bytes.
@@ -156,19 +230,169 @@ void SPIFlash::flash_write_status_register(uint8_t sreg)
 
    The READ DATA BYTES command is terminated by driving S# HIGH. S# can be driven HIGH at any time during data output.
    Any READ DATA BYTES command issued while an ERASE, PROGRAM, or WRITE cycle is in progress is rejected without any effect on the cycle that is in progress.
+
+   READ DATA BYTES may only be clocked up to fR, so when the SPI clock set by SPIset() is faster
+   the READ DATA BYTES at HIGHER SPEED command is used instead (see flash_fast_read_data_bytes()).
+   The data phase is shifted out as one block transfer rather than one SPI.transfer() call per byte.
+
+   When SPIFLASH_CACHE_PAGES is not 0, reads that fit in the cache are served page by page from RAM,
+   and only the missing pages are fetched from the device. While a PROGRAM, ERASE or WRITE cycle started
+   by the driver is still running, missing pages are read straight into buf and not cached:
+   the device does not return valid data during the cycle.
 */
 void SPIFlash::flash_read_data_bytes(uint32_t addr, uint8_t *buf, uint32_t siz)
 {
-  uint32_t i;
-  SPI_ASSERT();
-  SPI.transfer(SPI_READ_DATA_BYTES);
-  SPI.transfer(addr >> 16);
-  SPI.transfer(addr >>  8);
-  SPI.transfer(addr >>  0);
-  for (i = 0; i < siz; i++) {
-    buf[i] = SPI.transfer(0);
+#if SPIFLASH_CACHE_PAGES > 0
+  uint16_t page;
+  uint32_t off;
+  uint32_t n;
+  uint8_t slot;
+  bool cycle;
+
+  if (siz <= (uint32_t)SPIFLASH_CACHE_PAGES * flash_PAGE_BYTE_SIZE) {
+    cycle = _cycle_us != 0 && flash_busy();  // flash_busy() clears _cycle_us once WIP is 0
+    while (siz > 0) {
+      page = (addr / flash_PAGE_BYTE_SIZE) % flash_PAGE_COUNT;
+      off = addr % flash_PAGE_BYTE_SIZE;
+      n = flash_PAGE_BYTE_SIZE - off;
+      if (n > siz) {
+        n = siz;
+      }
+      for (slot = 0; slot < SPIFLASH_CACHE_PAGES; slot++) {
+        if (_cache_page[slot] == page) {
+          break;
+        }
+      }
+      if (slot < SPIFLASH_CACHE_PAGES) {
+        _cache_stats.hits++;
+      } else if (cycle) {
+        _cache_stats.misses++;
+        flash_read_array(addr, buf, n);
+        addr += n;
+        buf += n;
+        siz -= n;
+        continue;
+      } else {
+        // Clock eviction: skip (and clear) recently referenced slots.
+        while (_cache_page[_cache_hand] != flash_PAGE_COUNT && _cache_ref[_cache_hand]) {
+          _cache_ref[_cache_hand] = 0;
+          _cache_hand = (_cache_hand + 1) % SPIFLASH_CACHE_PAGES;
+        }
+        slot = _cache_hand;
+        _cache_hand = (_cache_hand + 1) % SPIFLASH_CACHE_PAGES;
+        _cache_stats.misses++;
+        flash_read_array((uint32_t)page * flash_PAGE_BYTE_SIZE, _cache_data[slot], flash_PAGE_BYTE_SIZE);
+        _cache_page[slot] = page;
+      }
+      _cache_ref[slot] = 1;
+      memcpy(buf, &_cache_data[slot][off], n);
+      addr += n;
+      buf += n;
+      siz -= n;
+    }
+    return;
+  }
+#endif
+  flash_read_array(addr, buf, siz);
+}
+/**
+   Issues READ DATA BYTES, or READ DATA BYTES at HIGHER SPEED above fR, without going through the cache.
+*/
+void SPIFlash::flash_read_array(uint32_t addr, uint8_t *buf, uint32_t siz)
+{
+  flash_xfer_t x;
+  uint32_t start;
+  if (_bus->clock_hz() > flash_READ_MAX_HZ) {
+    flash_fast_read_data_bytes(addr, buf, siz);
+    return;
+  }
+  start = flash_stats_now();
+  flash_xfer_set(&x, SPI_READ_DATA_BYTES, addr, 4);
+  x.rx = buf;
+  x.len = siz;
+  flash_exec(&x, 1);
+  flash_stats_sample(FLASH_STAT_READ, siz, start);
+  flash_trace(SPI_READ_DATA_BYTES, addr, siz);
+}
+/**
+   @brief Read Data Bytes at Higher Speed.
+   @details
+   The device is first selected by driving chip select (S#) LOW.
+   The command code for READ DATA BYTES at HIGHER SPEED is followed by a 3-byte address (A23-A0) and a dummy byte,
+   each bit being latched-in during the rising edge of serial clock (C).
+   Then the memory contents at that address are shifted out on serial data output (DQ1),
+   each bit being shifted out at a maximum frequency fC during the falling edge of C.
+   The first byte addressed can be at any location.
+   The address is automatically incremented to the next higher address after each byte of data is shifted out.
+   Therefore, the entire memory can be read with a single READ DATA BYTES at HIGHER SPEED command.
+   When the highest address is reached, the address counter rolls over to 000000h, allowing the read sequence to be continued indefinitely.
+   The READ DATA BYTES at HIGHER SPEED command is terminated by driving S# HIGH. S# can be driven HIGH at any time during data output.
+   Any READ DATA BYTES at HIGHER SPEED command issued while an ERASE, PROGRAM, or WRITE cycle is in progress
+   is rejected without any effect on the cycle that is in progress.
+
+   The bytes clocked out on DQ0 during the data phase are ignored by the device,
+   so the caller's buffer is exchanged in place with a single block transfer.
+*/
+void SPIFlash::flash_fast_read_data_bytes(uint32_t addr, uint8_t *buf, uint32_t siz)
+{
+  flash_xfer_t x;
+  uint32_t start = flash_stats_now();
+  flash_xfer_set(&x, SPIFLASH_ARRAYREAD, addr, 5);  // with the dummy byte
+  x.rx = buf;
+  x.len = siz;
+  flash_exec(&x, 1);
+  flash_stats_sample(FLASH_STAT_READ, siz, start);
+  flash_trace(SPIFLASH_ARRAYREAD, addr, siz);
+}
+/**
+   @brief Stream Read.
+   @details
+   Reads siz bytes at addr like flash_read_data_bytes(), but leaves the READ open afterwards:
+   S# stays LOW, and a following call whose addr is the byte after the last one read
+   continues the same READ, clocking only the data bytes, with no command, address or dummy byte.
+   Any other command, or flash_stream_end(), ends the READ; a later call simply starts a new one.
+   The read cache is bypassed. With a transport that cannot hold S# between calls (see
+   SPIFlashTransport::read_open()) every call is a READ of its own.
+   While the READ is open the SPI bus stays reserved, so call flash_stream_end() before using other devices on it.
+*/
+void SPIFlash::flash_stream_read(uint32_t addr, uint8_t *buf, uint32_t siz)
+{
+  flash_xfer_t x;
+  uint32_t start = flash_stats_now();
+  addr %= (uint32_t)flash_PAGE_COUNT * flash_PAGE_BYTE_SIZE;
+  if (!_stream_open || addr != _stream_addr) {
+    flash_wake();
+    if (_bus->clock_hz() > flash_READ_MAX_HZ) {
+      flash_xfer_set(&x, SPIFLASH_ARRAYREAD, addr, 5);
+    } else {
+      flash_xfer_set(&x, SPI_READ_DATA_BYTES, addr, 4);
+    }
+    if (!_bus->read_open(&x)) {
+      flash_read_array(addr, buf, siz);
+      return;
+    }
+    _stream_open = true;
+#if SPIFLASH_STATS
+    _stats.cs_pairs++;
+#endif
+    flash_trace(x.hdr[0], addr, siz);
+  }
+  _bus->read_next(buf, siz);
+  _stream_addr = (addr + siz) % ((uint32_t)flash_PAGE_COUNT * flash_PAGE_BYTE_SIZE);
+  flash_stats_sample(FLASH_STAT_READ, siz, start);
+  flash_mark_active();
+}
+/**
+   @brief Stream End.
+   @details
+   Ends the READ left open by flash_stream_read(), driving S# HIGH and releasing the SPI bus.
+*/
+void SPIFlash::flash_stream_end(void)
+{
+  if (_stream_open) {
+    _bus->read_close();
+    _stream_open = false;
   }
-  SPI_DEASSERT();
 }
 /**
    @brief Page Program.
@@ -196,19 +420,335 @@ void SPIFlash::flash_read_data_bytes(uint32_t addr, uint8_t *buf, uint32_t siz)
    The WIP bit is 1 during the self-timed PAGE PROGRAM cycle, and 0 when the cycle is completed.
    At some unspecified time before the cycle is completed, the write enable latch (WEL) bit is reset.
    A PAGE PROGRAM command is not executed if it applies to a page protected by the block protect bits BP2, BP1, and BP0.
+   The WRITE ENABLE is sent here, in the same batch as the command (see flash_send_enabled()).
+   Returns false if the device refused the command: WEL not set, a cycle in progress, or a protected page.
 */
-void SPIFlash::flash_page_program(uint32_t addr, uint8_t *buf, uint32_t siz)
+bool SPIFlash::flash_page_program(uint32_t addr, const uint8_t *buf, uint32_t siz)
 {
+  flash_xfer_t x;
+  bool ok;
+  flash_map_use(addr);
+  flash_cache_invalidate_page((addr / flash_PAGE_BYTE_SIZE) % flash_PAGE_COUNT);
+  flash_xfer_set(&x, SPI_PAGE_PROGRAM, addr, 4);
+  x.tx = buf;
+  x.len = siz;
+  ok = flash_accepts(flash_send_enabled(&x), addr);
+  if (ok) {
+    flash_cycle_expect(flash_tPP_US * siz / flash_PAGE_BYTE_SIZE);  // shorter pages program faster
+  }
+  flash_stats_cycle_start(FLASH_STAT_PROGRAM, siz);
+  flash_trace(SPI_PAGE_PROGRAM, addr, siz);
+  return ok;
+}
+/**
+   @brief Write.
+   @details
+   Programs len bytes starting at addr, for any length and alignment.
+   The range is split on page boundaries (flash_PAGE_BYTE_SIZE) so no PAGE PROGRAM wraps back to the start of its page.
+   Only the first and the last page of the range can be partial; every other PAGE PROGRAM carries a full page.
+   Each page goes out with its WRITE ENABLE as one batch, and the function waits for WIP to clear before it returns,
+   so the device is ready for the next command. The target area must have been erased beforehand.
+*/
+void SPIFlash::flash_write(uint32_t addr, const uint8_t *buf, uint32_t len)
+{
+  flash_program(addr, buf, len, NULL);
+}
+/**
+   @brief Write with CRC.
+   @details
+   Same as flash_write(), and returns the CRC-32 of the len bytes programmed.
+   The CRC of each page is computed while the device is busy with its PAGE PROGRAM cycle,
+   so it adds no time to the write; compare it with flash_crc32() or pass it to flash_verify().
+*/
+uint32_t SPIFlash::flash_write_crc(uint32_t addr, const uint8_t *buf, uint32_t len)
+{
+  uint32_t crc = 0;
+  flash_program(addr, buf, len, &crc);
+  return crc;
+}
+/**
+   Programs len bytes from addr one page at a time; when crc is not NULL,
+   the CRC of each page is accumulated into *crc during its tPP.
+*/
+void SPIFlash::flash_program(uint32_t addr, const uint8_t *buf, uint32_t len, uint32_t *crc)
+{
+  uint32_t chunk;
+  while (len > 0) {
+    chunk = flash_PAGE_BYTE_SIZE - (addr % flash_PAGE_BYTE_SIZE);
+    if (chunk > len) {
+      chunk = len;
+    }
+    flash_wait_ready();
+    flash_page_program(addr, buf, chunk);
+    if (crc != NULL) {
+      *crc = flash_crc32_update(*crc, buf, chunk);
+    }
+    addr += chunk;
+    buf += chunk;
+    len -= chunk;
+  }
+  flash_wait_ready();
+}
+/**
+   Sink of flash_crc32(): accumulates the CRC of the data into the uint32_t at ctx.
+*/
+static void flash_crc_sink(void *ctx, const uint8_t *data, uint32_t len)
+{
+  *(uint32_t *)ctx = flash_crc32_update(*(uint32_t *)ctx, data, len);
+}
+/**
+   @brief CRC-32.
+   @details
+   Returns the CRC-32 (as zlib's crc32()) of the len bytes at addr.
+   The data is read with a single READ DATA BYTES command (at HIGHER SPEED above fR) and fed to the CRC
+   as it comes off the bus, in chunks of SPIFLASH_STREAM_CHUNK bytes, so no buffer of len bytes is needed.
+   The read cache is bypassed. The address rolls over to 000000h past the highest address.
+*/
+uint32_t SPIFlash::flash_crc32(uint32_t addr, uint32_t len)
+{
+  flash_xfer_t x;
+  uint32_t crc = 0;
+  uint32_t start = flash_stats_now();
+  if (_bus->clock_hz() > flash_READ_MAX_HZ) {
+    flash_xfer_set(&x, SPIFLASH_ARRAYREAD, addr, 5);
+  } else {
+    flash_xfer_set(&x, SPI_READ_DATA_BYTES, addr, 4);
+  }
+  x.len = len;
+  flash_wake();
+#if SPIFLASH_STATS
+  _stats.cs_pairs++;
+#endif
+  _bus->read_stream(&x, flash_crc_sink, &crc);
+  flash_mark_active();
+  flash_stats_sample(FLASH_STAT_READ, len, start);
+  flash_trace(x.hdr[0], addr, len);
+  return crc;
+}
+/**
+   @brief Verify.
+   @details
+   Returns true when the CRC-32 of the len bytes at addr is expected_crc, e.g. the value returned by flash_write_crc().
+*/
+bool SPIFlash::flash_verify(uint32_t addr, uint32_t expected_crc, uint32_t len)
+{
+  return flash_crc32(addr, len) == expected_crc;
+}
+/**
+   @brief Smart Write.
+   @details
+   Makes the len bytes at addr equal to buf, erasing only where the device cannot get there by programming.
+   The range is compared with the device contents one 64 KB sector at a time:
+   - pages that already hold the data are not programmed at all,
+   - if every changed bit goes from 1 to 0, the changed span of each page is programmed in place,
+   - otherwise the sector is erased. Its other bytes are preserved by first copying them to the scratch sector
+     (any address inside a sector outside the target one), which is erased first if it is not blank.
+     A reset during the copy back leaves the old contents of the sector in the scratch sector.
+   Returns false, leaving the sector unchanged, when an erase is required and no usable scratch sector was given;
+   sectors before it in the range have already been written.
+*/
+bool SPIFlash::flash_smart_write(uint32_t addr, const uint8_t *buf, uint32_t len, uint32_t scratch)
+{
+  uint32_t chunk;
+  while (len > 0) {
+    chunk = flash_SECTOR_BYTE_SIZE - (addr % flash_SECTOR_BYTE_SIZE);
+    if (chunk > len) {
+      chunk = len;
+    }
+    if (flash_sector_is_erased((addr / flash_SECTOR_BYTE_SIZE) % flash_SECTOR_COUNT)) {
+      flash_write(addr, buf, chunk);
+    } else if (!flash_needs_erase(addr, buf, chunk)) {
+      flash_program_changed(addr, buf, chunk);
+    } else if (scratch < (uint32_t)flash_SECTOR_COUNT * flash_SECTOR_BYTE_SIZE &&
+               scratch / flash_SECTOR_BYTE_SIZE != addr / flash_SECTOR_BYTE_SIZE) {
+      flash_rewrite_sector(addr, buf, chunk, scratch - (scratch % flash_SECTOR_BYTE_SIZE));
+    } else {
+      return false;
+    }
+    addr += chunk;
+    buf += chunk;
+    len -= chunk;
+  }
+  return true;
+}
+/**
+   Returns true if some bit of [addr, addr + len) has to go from 0 to 1 to hold buf.
+*/
+bool SPIFlash::flash_needs_erase(uint32_t addr, const uint8_t *buf, uint32_t len)
+{
+  uint8_t old[flash_PAGE_BYTE_SIZE];
+  uint32_t chunk;
   uint32_t i;
-  SPI_ASSERT();
-  SPI.transfer(SPI_PAGE_PROGRAM);
-  SPI.transfer(addr >> 16);
-  SPI.transfer(addr >>  8);
-  SPI.transfer(addr >>  0);
-  for (i = 0; i < siz; i++) {
-    SPI.transfer(buf[i]);
+  while (len > 0) {
+    chunk = flash_PAGE_BYTE_SIZE - (addr % flash_PAGE_BYTE_SIZE);
+    if (chunk > len) {
+      chunk = len;
+    }
+    flash_read_data_bytes(addr, old, chunk);
+    for (i = 0; i < chunk; i++) {
+      if ((old[i] & buf[i]) != buf[i]) {
+        return true;
+      }
+    }
+    addr += chunk;
+    buf += chunk;
+    len -= chunk;
   }
-  SPI_DEASSERT();
+  return false;
+}
+/**
+   Programs, page by page, the span between the first and the last byte that differs from the device.
+   Every change must be a 1 to 0 transition.
+*/
+void SPIFlash::flash_program_changed(uint32_t addr, const uint8_t *buf, uint32_t len)
+{
+  uint8_t old[flash_PAGE_BYTE_SIZE];
+  uint32_t chunk;
+  uint32_t first;
+  uint32_t last;
+  while (len > 0) {
+    chunk = flash_PAGE_BYTE_SIZE - (addr % flash_PAGE_BYTE_SIZE);
+    if (chunk > len) {
+      chunk = len;
+    }
+    flash_read_data_bytes(addr, old, chunk);
+    for (first = 0; first < chunk && old[first] == buf[first]; first++) {
+    }
+    if (first < chunk) {
+      for (last = chunk - 1; old[last] == buf[last]; last--) {
+      }
+      flash_write(addr + first, buf + first, last - first + 1);
+    }
+    addr += chunk;
+    buf += chunk;
+    len -= chunk;
+  }
+}
+/**
+   Erases the sector holding [addr, addr + len), which must not cross a sector boundary,
+   and programs it back with buf over its previous contents, staged in the scratch sector.
+*/
+void SPIFlash::flash_rewrite_sector(uint32_t addr, const uint8_t *buf, uint32_t len, uint32_t scratch)
+{
+  uint8_t data[flash_PAGE_BYTE_SIZE];
+  uint32_t base = addr - (addr % flash_SECTOR_BYTE_SIZE);
+  uint32_t page;
+  uint32_t i;
+  bool covered;
+  bool blank = true;
+
+  for (page = 0; page < flash_SECTOR_BYTE_SIZE && blank; page += flash_PAGE_BYTE_SIZE) {
+    flash_read_data_bytes(scratch + page, data, flash_PAGE_BYTE_SIZE);
+    for (i = 0; i < flash_PAGE_BYTE_SIZE && blank; i++) {
+      blank = data[i] == 0xFF;
+    }
+  }
+  if (!blank) {
+    flash_erase_and_wait(scratch);
+  }
+  // Save the pages the new data does not fully replace.
+  for (page = 0; page < flash_SECTOR_BYTE_SIZE; page += flash_PAGE_BYTE_SIZE) {
+    covered = addr <= base + page && addr + len >= base + page + flash_PAGE_BYTE_SIZE;
+    if (covered) {
+      continue;
+    }
+    flash_read_data_bytes(base + page, data, flash_PAGE_BYTE_SIZE);
+    for (i = 0; i < flash_PAGE_BYTE_SIZE && data[i] == 0xFF; i++) {
+    }
+    if (i < flash_PAGE_BYTE_SIZE) {
+      flash_write(scratch + page, data, flash_PAGE_BYTE_SIZE);
+    }
+  }
+  flash_erase_and_wait(base);
+  for (page = 0; page < flash_SECTOR_BYTE_SIZE; page += flash_PAGE_BYTE_SIZE) {
+    covered = addr <= base + page && addr + len >= base + page + flash_PAGE_BYTE_SIZE;
+    if (!covered) {
+      flash_read_data_bytes(scratch + page, data, flash_PAGE_BYTE_SIZE);
+    }
+    flash_overlay_page(base + page, data, addr, buf, len);
+    for (i = 0; i < flash_PAGE_BYTE_SIZE && data[i] == 0xFF; i++) {
+    }
+    if (i < flash_PAGE_BYTE_SIZE) {
+      flash_write(base + page, data, flash_PAGE_BYTE_SIZE);
+    }
+  }
+}
+/**
+   Copies the part of [addr, addr + len) that falls in the page starting at page into data.
+*/
+void SPIFlash::flash_overlay_page(uint32_t page, uint8_t *data, uint32_t addr, const uint8_t *buf, uint32_t len)
+{
+  uint32_t lo = (addr > page) ? addr : page;
+  uint32_t hi = (addr + len < page + flash_PAGE_BYTE_SIZE) ? addr + len : page + flash_PAGE_BYTE_SIZE;
+  if (lo < hi) {
+    memcpy(&data[lo - page], buf + (lo - addr), hi - lo);
+  }
+}
+void SPIFlash::flash_erase_and_wait(uint32_t addr)
+{
+  flash_wait_ready();
+  flash_sector_erase(addr);
+  flash_wait_ready();
+}
+/**
+   @brief Busy.
+   @details
+   Reads the status register once and returns true while a PROGRAM, ERASE, or WRITE STATUS REGISTER cycle is in progress.
+   It never blocks, so it can be used to poll the self-timed cycles from a main loop.
+   In DEEP POWER-DOWN it returns false without waking the device.
+*/
+bool SPIFlash::flash_busy(void)
+{
+  uint8_t sreg;
+  if (_power == FLASH_POWER_DOWN) {
+    return false;
+  }
+  flash_read_status_register(&sreg);
+  if (FLASH_SREG_WRITE_IN_PROGRESS(sreg)) {
+    return true;
+  }
+  flash_stats_cycle_end();
+  flash_map_settle();
+  _cycle_us = 0;
+  return false;
+}
+/**
+   @brief Wait Ready.
+   @details
+   Blocks until the write in progress (WIP) bit is 0.
+   The status register is read continuously with a single READ STATUS REGISTER command.
+   The transport is told how long the cycle started last is still expected to take, so a backend
+   with a per-poll cost can sleep instead of polling.
+   In DEEP POWER-DOWN it returns at once without waking the device.
+*/
+void SPIFlash::flash_wait_ready(void)
+{
+  uint32_t start = flash_stats_now();
+  uint32_t polls;
+  uint32_t spent;
+  uint32_t expect = 0;
+  if (_power == FLASH_POWER_DOWN) {
+    return;
+  }
+  flash_wake();
+#if SPIFLASH_STATS
+  _stats.cs_pairs++;
+#endif
+  if (_cycle_us > 0) {
+    spent = _bus->now_us() - _cycle_at;
+    expect = (spent < _cycle_us) ? _cycle_us - spent : 0;
+  }
+  polls = _bus->wait_ready(expect);
+  flash_mark_active();
+  flash_stats_cycle_end();
+  flash_map_settle();
+  _cycle_us = 0;
+#if SPIFLASH_STATS
+  _stats.wait_us += flash_stats_now() - start;
+#else
+  (void)start;
+#endif
+  flash_trace(SPI_READ_STATUS_REGISTER, 0, polls);
 }
 /**
    @brief Sector Erase.
@@ -227,22 +767,31 @@ void SPIFlash::flash_page_program(uint32_t addr, uint8_t *buf, uint32_t siz)
    The WIP bit is 1 during the self-timed SECTOR ERASE cycle, and is 0 when the cycle is completed.
    At some unspecified time before the cycle is completed, the WEL bit is reset.
    A SECTOR ERASE command is not executed if it applies to a sector that is hardware or software protected.
+   The WRITE ENABLE is sent here, in the same batch as the command (see flash_send_enabled()).
+   Returns false if the device refused the command: WEL not set, a cycle in progress, or a protected sector.
 */
-void SPIFlash::flash_sector_erase(uint32_t addr)
+bool SPIFlash::flash_sector_erase(uint32_t addr)
 {
-  SPI_ASSERT();
-  SPI.transfer(SPI_SECTOR_ERASE);
-  SPI.transfer(addr >> 16);
-  SPI.transfer(addr >>  8);
-  SPI.transfer(addr >>  0);
-  SPI_DEASSERT();
+  flash_xfer_t x;
+  bool ok;
+  flash_cache_invalidate_sector((addr / flash_SECTOR_BYTE_SIZE) % flash_SECTOR_COUNT);
+  flash_xfer_set(&x, SPI_SECTOR_ERASE, addr, 4);
+  ok = flash_accepts(flash_send_enabled(&x), addr);
+  if (ok) {
+    flash_cycle_expect(flash_tSE_US);
+    flash_map_erasing(addr);
+  }
+  flash_stats_cycle_start(FLASH_STAT_SECTOR_ERASE, flash_SECTOR_BYTE_SIZE);
+  flash_trace(SPI_SECTOR_ERASE, addr, 0);
+  return ok;
 }
 
 /**
    @brief Bulk Erase.
    @details
    The BULK ERASE command sets all bits to 1 (FFh).
-   Before the BULK ERASE command can be accepted, a WRITE ENABLE command must have been executed previously.
+   Before the BULK ERASE command can be accepted, a WRITE ENABLE command must have been executed previously;
+   it is sent here, in the same batch as the command (see flash_send_enabled()).
    After the WRITE ENABLE command has been decoded, the device sets the write enable latch (WEL) bit.
    The BULK ERASE command is entered by driving chip select (S#) LOW,
    followed by the command code on serial data input (DQ0).
@@ -255,12 +804,27 @@ void SPIFlash::flash_sector_erase(uint32_t addr)
    At some unspecified time before the cycle is completed, the WEL bit is reset.
    The BULK ERASE command is executed only if all block protect (BP2, BP1, BP0) bits are 0.
    The BULK ERASE command is ignored if one or more sectors are protected.
+   Returns false if the device refused the command: WEL not set, a cycle in progress, or a protected sector.
 */
-void SPIFlash::flash_bulk_erase(void)
+bool SPIFlash::flash_bulk_erase(void)
 {
-  SPI_ASSERT();
-  SPI.transfer(SPI_BULK_ERASE);
-  SPI_DEASSERT();
+  flash_xfer_t x;
+  uint8_t sreg;
+  bool ok;
+  flash_cache_invalidate();
+  flash_xfer_set(&x, SPI_BULK_ERASE, 0, 1);
+  sreg = flash_send_enabled(&x);
+  ok = flash_accepts(sreg, 0) && !FLASH_SREG_BLOCK_PROTECT_BP2(sreg) &&
+       !FLASH_SREG_BLOCK_PROTECT_BP1(sreg) && !FLASH_SREG_BLOCK_PROTECT_BP0(sreg);
+  if (ok) {
+    flash_cycle_expect(flash_tBE_US);
+    if (_map_sector < flash_SECTOR_COUNT) {
+      _map_erasing = 0xFFFFFFFFUL;
+    }
+  }
+  flash_stats_cycle_start(FLASH_STAT_BULK_ERASE, (uint32_t)flash_SECTOR_COUNT * flash_SECTOR_BYTE_SIZE);
+  flash_trace(SPI_BULK_ERASE, 0, 0);
+  return ok;
 }
 /**
    @brief Deep Power Down.
@@ -281,12 +845,23 @@ void SPIFlash::flash_bulk_erase(void)
    it requires a delay of tDP before the supply current is reduced to ICC2 and the DEEP POWER-DOWN mode is entered.
    Any DEEP POWER-DOWN command issued while an ERASE, PROGRAM, or WRITE cycle is in progress is rejected
    without any effect on the cycle that is in progress.
+
+   The driver first waits for such a cycle to complete, and remembers that the device is asleep:
+   flash_busy() and flash_wait_ready() then return without selecting it,
+   and any other command first wakes it up (see flash_release_from_deep_power_down()).
 */
 void SPIFlash::flash_deep_power_down(void)
 {
-  SPI_ASSERT();
-  SPI.transfer(SPI_DEEP_POWER_DOWN);
-  SPI_DEASSERT();
+  flash_xfer_t x;
+  if (_power == FLASH_POWER_DOWN) {
+    return;
+  }
+  flash_wait_ready();
+  flash_xfer_set(&x, SPI_DEEP_POWER_DOWN, 0, 1);
+  flash_exec(&x, 1);
+  _power = FLASH_POWER_DOWN;
+  _power_at = _bus->now_us();
+  flash_trace(SPI_DEEP_POWER_DOWN, 0, 0);
 }
 /**
    @brief Release From Deep Power Down.
@@ -301,10 +876,631 @@ void SPIFlash::flash_deep_power_down(void)
    After S# has been driven HIGH, followed by a delay, tRES, the device is put in the STANDBY mode.
    S# must remain HIGH at least until this period is over. The device waits to be selected so that it can receive, decode, and execute commands.
    Any RELEASE from DEEP POWER-DOWN command issued while an ERASE, PROGRAM, or WRITE cycle is in progress is rejected without any effect on the cycle that is in progress.
+
+   The function does not wait for tRES: the next command waits for whatever part of it has not elapsed yet.
+   Calling it ahead of an access therefore hides the wake-up time behind other work.
+   Commands sent while the device is asleep wake it the same way, so calling it is never required.
+   Does nothing unless flash_deep_power_down() put the device to sleep, so an awake device never waits tRES.
 */
 void SPIFlash::flash_release_from_deep_power_down(void)
 {
-  SPI_ASSERT();
-  SPI.transfer(SPI_RELEASE_FROM_DEEP_POWER_DOWN);
-  SPI_DEASSERT();
+  flash_xfer_t x;
+  if (_power != FLASH_POWER_DOWN) {
+    return;
+  }
+  flash_power_delay(flash_tDP_US);
+  flash_xfer_set(&x, SPI_RELEASE_FROM_DEEP_POWER_DOWN, 0, 1);
+#if SPIFLASH_STATS
+  _stats.cs_pairs++;
+#endif
+  _bus->run(&x, 1);
+  _power = FLASH_POWER_WAKING;
+  _power_at = _bus->now_us();
+  flash_trace(SPI_RELEASE_FROM_DEEP_POWER_DOWN, 0, 0);
+}
+/**
+   @brief Set Auto Power Down.
+   @details
+   Lets flash_idle() put the device in DEEP POWER-DOWN once no command has been sent for idle_us microseconds.
+   0 (the default) turns the policy off. The time base is the transport's now_us().
+*/
+void SPIFlash::flash_set_auto_power_down(uint32_t idle_us)
+{
+  _idle_us = idle_us;
+  _last_us = _bus->now_us();
+}
+/**
+   @brief Idle.
+   @details
+   To be called whenever the application has nothing for the device, e.g. from loop().
+   Enters DEEP POWER-DOWN when auto power-down is on, the last command is older than the idle time
+   and no PROGRAM or ERASE cycle is in progress. Returns true while the device is in DEEP POWER-DOWN.
+   With the erased-sector map mounted, pending erase-ahead work and snapshots of the map come first
+   (see flash_set_erase_ahead()).
+*/
+bool SPIFlash::flash_idle(void)
+{
+  if (flash_map_task()) {
+    return false;
+  }
+  if (_power == FLASH_POWER_DOWN) {
+    return true;
+  }
+  if (_idle_us == 0 || _bus->now_us() - _last_us < _idle_us || flash_busy()) {
+    return false;
+  }
+  flash_deep_power_down();
+  return true;
+}
+/**
+   @brief Now.
+   @details
+   Returns the transport's now_us(), the time base of the driver, for layers that keep their own timings.
+*/
+uint32_t SPIFlash::flash_now_us(void)
+{
+  return _bus->now_us();
+}
+/**
+   @brief Map Mount.
+   @details
+   Turns on the erased-sector map, kept in map_sector, which is reserved for it from then on.
+   The map has one bit per sector telling whether the sector is known to be erased, and one telling
+   whether its contents are no longer needed (flash_sector_free()), which makes it a candidate for erase-ahead.
+   The map is saved as a snapshot appended to map_sector; mount() finds the last one with a binary search
+   over the snapshot slots, a dozen short reads. Returns false, with an empty map, when map_sector holds
+   no valid snapshot; it is then erased before the first snapshot is written.
+   A map_sector of flash_SECTOR_COUNT or more turns the map off.
+
+   A sector loses its erased bit, on flash, before it is first programmed, and gains it in RAM once erased;
+   the erased bits are saved by flash_idle() or with the next snapshot. A power loss at any point therefore
+   only loses knowledge: no sector is ever taken for erased when it is not.
+   Sectors under block protection must not be freed, since their erase is ignored by the device.
+*/
+bool SPIFlash::flash_map_mount(uint8_t map_sector)
+{
+  uint16_t lo = 0;
+  uint16_t hi = FLASH_MAP_SLOTS;
+  uint16_t mid;
+  uint16_t slot;
+  uint32_t erased;
+  uint32_t free_mask;
+  uint8_t raw[FLASH_MAP_SLOT_SIZE];
+  uint8_t i;
+
+  _map_sector = (map_sector < flash_SECTOR_COUNT) ? map_sector : flash_SECTOR_COUNT;
+  _map_erased = 0;
+  _map_free = 0;
+  _map_stored_erased = 0;
+  _map_stored_free = 0;
+  _map_erasing = 0;
+  if (_map_sector == flash_SECTOR_COUNT) {
+    return false;
+  }
+  // Snapshots are written from slot 0 on, so the used slots are a prefix of the sector.
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    flash_read_data_bytes((uint32_t)_map_sector * flash_SECTOR_BYTE_SIZE + (uint32_t)mid * FLASH_MAP_SLOT_SIZE,
+                          raw, sizeof(raw));
+    for (i = 0; i < sizeof(raw) && raw[i] == 0xFF; i++) {
+    }
+    if (i < sizeof(raw)) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  _map_slot = lo;
+  // The last slot may be torn by a power loss: fall back to the one before it.
+  for (slot = lo; slot > 0 && slot + 2 > lo; slot--) {
+    if (flash_map_read_slot(slot - 1, &erased, &free_mask)) {
+      _map_erased = erased & ~(1UL << _map_sector);
+      _map_free = free_mask & ~(1UL << _map_sector);
+      _map_stored_erased = _map_erased;
+      _map_stored_free = _map_free;
+      return true;
+    }
+  }
+  if (lo > 0) {
+    _map_slot = FLASH_MAP_SLOTS;
+  }
+  return false;
+}
+/**
+   @brief Sector Free.
+   @details
+   Tells the erased-sector map that the contents of sector are no longer needed.
+   Erase-ahead erases such sectors in idle time; the sector stays free until it is programmed again.
+*/
+void SPIFlash::flash_sector_free(uint8_t sector)
+{
+  if (_map_sector < flash_SECTOR_COUNT && sector < flash_SECTOR_COUNT && sector != _map_sector) {
+    _map_free |= 1UL << sector;
+  }
+}
+/**
+   @brief Sector Is Erased.
+   @details
+   Returns true when the erased-sector map knows sector to be erased, so it can be programmed without an erase.
+*/
+bool SPIFlash::flash_sector_is_erased(uint8_t sector)
+{
+  return sector < flash_SECTOR_COUNT && (_map_erased & (1UL << sector)) != 0;
+}
+/**
+   @brief Find Erased Sector.
+   @details
+   Returns the lowest sector known to be erased, or -1 if there is none.
+*/
+int8_t SPIFlash::flash_find_erased_sector(void)
+{
+  uint8_t sector;
+  for (sector = 0; sector < flash_SECTOR_COUNT; sector++) {
+    if (_map_erased & (1UL << sector)) {
+      return sector;
+    }
+  }
+  return -1;
+}
+/**
+   @brief Set Erase Ahead.
+   @details
+   When on, flash_idle() starts a SECTOR ERASE of one free sector not yet erased whenever the device is not busy,
+   and returns at once, so the tSE of the erase is spent in idle time instead of in front of a write.
+   Needs the erased-sector map (flash_map_mount()).
+*/
+void SPIFlash::flash_set_erase_ahead(bool on)
+{
+  _erase_ahead = on;
+}
+/**
+   Background work of the erased-sector map for flash_idle(): starts the erase of the next free sector
+   when erase-ahead is on, otherwise saves the map if it changed. Returns true while there is work left
+   or the device is busy.
+*/
+bool SPIFlash::flash_map_task(void)
+{
+  uint32_t todo;
+  uint8_t sector;
+
+  if (_map_sector >= flash_SECTOR_COUNT) {
+    return false;
+  }
+  todo = _erase_ahead ? (_map_free & ~_map_erased) : 0;
+  if (todo == 0 && _map_erased == _map_stored_erased && _map_free == _map_stored_free) {
+    return false;
+  }
+  if (flash_busy()) {
+    return true;
+  }
+  if (todo == 0) {
+    flash_map_store();
+    return false;
+  }
+  for (sector = 0; !(todo & (1UL << sector)); sector++) {
+  }
+  flash_sector_erase((uint32_t)sector * flash_SECTOR_BYTE_SIZE);
+  return true;
+}
+/**
+   Appends a snapshot of the map to the map sector, erasing the sector first when it is full,
+   and waits for it to be programmed.
+*/
+void SPIFlash::flash_map_store(void)
+{
+  uint8_t raw[12];
+  uint32_t crc;
+  uint8_t i;
+
+  if (_map_slot >= FLASH_MAP_SLOTS) {
+    flash_erase_and_wait((uint32_t)_map_sector * flash_SECTOR_BYTE_SIZE);
+    if (_map_slot >= FLASH_MAP_SLOTS) {
+      return;  // the erase was refused, the snapshot waits for the next call
+    }
+  }
+  for (i = 0; i < 4; i++) {
+    raw[i] = _map_erased >> (8 * i);
+    raw[4 + i] = _map_free >> (8 * i);
+  }
+  crc = flash_crc32_update(0, raw, 8);
+  for (i = 0; i < 4; i++) {
+    raw[8 + i] = crc >> (8 * i);
+  }
+  _map_stored_erased = _map_erased;
+  _map_stored_free = _map_free;
+  flash_write((uint32_t)_map_sector * flash_SECTOR_BYTE_SIZE + (uint32_t)_map_slot * FLASH_MAP_SLOT_SIZE, raw, sizeof(raw));
+  _map_slot++;
+}
+/**
+   Called before the sector holding addr is programmed: it is neither erased nor free any more.
+   If the saved map still says otherwise, a snapshot is written first, so a power loss cannot leave
+   a map calling the sector erased.
+*/
+void SPIFlash::flash_map_use(uint32_t addr)
+{
+  uint32_t bit = 1UL << ((addr / flash_SECTOR_BYTE_SIZE) % flash_SECTOR_COUNT);
+  _map_erasing &= ~bit;
+  if (!((_map_erased | _map_free) & bit)) {
+    return;
+  }
+  _map_erased &= ~bit;
+  _map_free &= ~bit;
+  if (!((_map_stored_erased | _map_stored_free) & bit)) {
+    return;
+  }
+  flash_wait_ready();
+  flash_map_store();
+}
+/**
+   Called once the device has accepted a SECTOR ERASE of the sector holding addr (see flash_accepts()).
+   The sector is recorded as being erased, and flash_map_settle() makes it erased once WIP clears.
+*/
+void SPIFlash::flash_map_erasing(uint32_t addr)
+{
+  if (_map_sector < flash_SECTOR_COUNT) {
+    _map_erasing |= 1UL << ((addr / flash_SECTOR_BYTE_SIZE) % flash_SECTOR_COUNT);
+  }
+}
+/**
+   Called once WIP is seen at 0: the sectors of the erase that just completed become erased.
+   An erase of the map sector itself drops the snapshots.
+*/
+void SPIFlash::flash_map_settle(void)
+{
+  uint32_t map_bit;
+  if (_map_erasing == 0) {
+    return;
+  }
+  map_bit = 1UL << _map_sector;
+  if (_map_erasing & map_bit) {
+    _map_slot = 0;
+    _map_stored_erased = 0;
+    _map_stored_free = 0;
+  }
+  _map_erased |= _map_erasing & ~map_bit;
+  _map_erasing = 0;
+}
+/**
+   Reads snapshot slot of the map sector. Returns false if it does not hold a valid snapshot.
+*/
+bool SPIFlash::flash_map_read_slot(uint16_t slot, uint32_t *erased, uint32_t *free_mask)
+{
+  uint8_t raw[12];
+  uint32_t crc = 0;
+  uint8_t i;
+
+  flash_read_data_bytes((uint32_t)_map_sector * flash_SECTOR_BYTE_SIZE + (uint32_t)slot * FLASH_MAP_SLOT_SIZE,
+                        raw, sizeof(raw));
+  *erased = 0;
+  *free_mask = 0;
+  for (i = 0; i < 4; i++) {
+    *erased |= (uint32_t)raw[i] << (8 * i);
+    *free_mask |= (uint32_t)raw[4 + i] << (8 * i);
+    crc |= (uint32_t)raw[8 + i] << (8 * i);
+  }
+  return crc == flash_crc32_update(0, raw, 8);
+}
+/**
+   Sends WRITE ENABLE, READ STATUS REGISTER and cmd as one batch, so a transport with a per-call cost
+   needs a single call, and returns the status register read between the first two.
+*/
+uint8_t SPIFlash::flash_send_enabled(const flash_xfer_t *cmd)
+{
+  flash_xfer_t x[3];
+  uint8_t sreg = 0;
+  flash_xfer_set(&x[0], SPI_WRITE_ENABLE, 0, 1);
+  flash_xfer_set(&x[1], SPI_READ_STATUS_REGISTER, 0, 1);
+  x[1].rx = &sreg;
+  x[1].len = 1;
+  x[2] = *cmd;
+  flash_exec(x, 3);
+  return sreg;
+}
+/**
+   Tells from the status register read just before a PROGRAM or ERASE whether the device accepts it:
+   WEL must be set, no cycle in progress, and addr outside the area protected by BP2, BP1 and BP0.
+*/
+bool SPIFlash::flash_accepts(uint8_t sreg, uint32_t addr)
+{
+  uint8_t sector = (addr / flash_SECTOR_BYTE_SIZE) % flash_SECTOR_COUNT;
+  uint8_t bp = (sreg >> 2) & 0x07;
+  if (!FLASH_SREG_WRITE_ENABLE_LATCH(sreg) || FLASH_SREG_WRITE_IN_PROGRESS(sreg)) {
+    return false;
+  }
+  // BP = 1..5 protects the upper 1/32, 1/16, 1/8, 1/4 or 1/2 of the sectors, 6 and 7 all of them.
+  return bp == 0 || (bp < 6 && sector < flash_SECTOR_COUNT - (1 << (bp - 1)));
+}
+/**
+   Records that a self-timed cycle of typical duration typ_us has just started, for flash_wait_ready().
+*/
+void SPIFlash::flash_cycle_expect(uint32_t typ_us)
+{
+  _cycle_at = _bus->now_us();
+  _cycle_us = typ_us;
+}
+/**
+   Hands a batch of commands to the transport.
+*/
+void SPIFlash::flash_exec(const flash_xfer_t *xfers, uint8_t count)
+{
+  flash_wake();
+#if SPIFLASH_STATS
+  _stats.cs_pairs += count;
+#endif
+  _bus->run(xfers, count);
+  flash_mark_active();
+}
+/**
+   Makes sure the device accepts commands: ends the READ left open by flash_stream_read(),
+   sends RELEASE from DEEP POWER-DOWN if it is asleep, then waits for the rest of tRES.
+*/
+void SPIFlash::flash_wake(void)
+{
+  flash_stream_end();
+  if (_power == FLASH_POWER_STANDBY) {
+    return;
+  }
+  if (_power == FLASH_POWER_DOWN) {
+    flash_release_from_deep_power_down();
+  }
+  flash_power_delay(flash_tRES_US);
+  _power = FLASH_POWER_STANDBY;
+}
+/**
+   Restarts the idle time of auto power-down after a command.
+*/
+void SPIFlash::flash_mark_active(void)
+{
+  if (_idle_us != 0) {
+    _last_us = _bus->now_us();
+  }
+}
+/**
+   Waits until more than us microseconds have passed since _power_at. The margin of 1 us covers
+   the truncation of now_us(); no delay at all is inserted when that time is already over.
+*/
+void SPIFlash::flash_power_delay(uint32_t us)
+{
+  uint32_t spent = _bus->now_us() - _power_at;
+  if (spent <= us) {
+    _bus->delay_us(us + 1 - spent);
+  }
+}
+/**
+   Fills in a command without data phase: cmd followed, when hdr_len is 4 or 5, by the 3-byte address
+   and, when it is 5, by a dummy byte.
+*/
+void SPIFlash::flash_xfer_set(flash_xfer_t *x, uint8_t cmd, uint32_t addr, uint8_t hdr_len)
+{
+  x->hdr[0] = cmd;
+  x->hdr[1] = addr >> 16;
+  x->hdr[2] = addr >> 8;
+  x->hdr[3] = addr >> 0;
+  x->hdr[4] = 0;
+  x->hdr_len = hdr_len;
+  x->tx = NULL;
+  x->rx = NULL;
+  x->len = 0;
+}
+/**
+   @brief Cache Invalidate.
+   @details
+   Drops every page held in the read cache. The driver calls this itself on BULK ERASE;
+   call it after the array has been changed behind the driver's back (e.g. by another SPI master).
+*/
+void SPIFlash::flash_cache_invalidate(void)
+{
+#if SPIFLASH_CACHE_PAGES > 0
+  uint8_t slot;
+  for (slot = 0; slot < SPIFLASH_CACHE_PAGES; slot++) {
+    _cache_page[slot] = flash_PAGE_COUNT;
+    _cache_ref[slot] = 0;
+  }
+  _cache_hand = 0;
+#endif
+}
+/**
+   @brief Cache Statistics.
+   @details
+   Returns the read cache hit and miss counters, counted per page touched by flash_read_data_bytes().
+   Both are 0 when the cache is compiled out.
+*/
+void SPIFlash::flash_cache_get_stats(flash_cache_stats_t *stats)
+{
+#if SPIFLASH_CACHE_PAGES > 0
+  *stats = _cache_stats;
+#else
+  stats->hits = 0;
+  stats->misses = 0;
+#endif
+}
+void SPIFlash::flash_cache_reset_stats(void)
+{
+#if SPIFLASH_CACHE_PAGES > 0
+  _cache_stats.hits = 0;
+  _cache_stats.misses = 0;
+#endif
+}
+void SPIFlash::flash_cache_invalidate_page(uint16_t page)
+{
+#if SPIFLASH_CACHE_PAGES > 0
+  uint8_t slot;
+  for (slot = 0; slot < SPIFLASH_CACHE_PAGES; slot++) {
+    if (_cache_page[slot] == page) {
+      _cache_page[slot] = flash_PAGE_COUNT;
+      _cache_ref[slot] = 0;
+    }
+  }
+#else
+  (void)page;
+#endif
+}
+void SPIFlash::flash_cache_invalidate_sector(uint8_t sector)
+{
+#if SPIFLASH_CACHE_PAGES > 0
+  uint8_t slot;
+  for (slot = 0; slot < SPIFLASH_CACHE_PAGES; slot++) {
+    if (_cache_page[slot] != flash_PAGE_COUNT &&
+        _cache_page[slot] / (flash_SECTOR_BYTE_SIZE / flash_PAGE_BYTE_SIZE) == sector) {
+      _cache_page[slot] = flash_PAGE_COUNT;
+      _cache_ref[slot] = 0;
+    }
+  }
+#else
+  (void)sector;
+#endif
+}
+/**
+   @brief Statistics.
+   @details
+   Returns the counters collected since the last flash_reset_stats() when SPIFLASH_STATS is 1, all 0 otherwise.
+   READ latency is the duration of the command on the bus (cache hits are not counted).
+   PROGRAM and ERASE latency runs from S# HIGH to the flash_busy() or flash_wait_ready() call that finds WIP 0,
+   so it includes the polling interval of the caller.
+*/
+void SPIFlash::flash_get_stats(flash_stats_t *stats)
+{
+#if SPIFLASH_STATS
+  *stats = _stats;
+#else
+  memset(stats, 0, sizeof(*stats));
+#endif
+}
+void SPIFlash::flash_reset_stats(void)
+{
+#if SPIFLASH_STATS
+  uint8_t i;
+  memset(&_stats, 0, sizeof(_stats));
+  for (i = 0; i < FLASH_STAT_OPS; i++) {
+    _stats.op[i].min_us = 0xFFFFFFFFUL;
+  }
+  _stats_cycle = FLASH_STAT_OPS;
+#endif
+}
+/**
+   @brief Dump Statistics.
+   @details
+   Prints one line per operation (count, bytes, min/avg/max latency in us), the number of commands and the
+   time spent waiting for WIP, e.g. to Serial. Prints nothing when SPIFLASH_STATS is 0.
+*/
+#ifdef ARDUINO
+void SPIFlash::flash_stats_dump(Print &out)
+{
+#if SPIFLASH_STATS
+  static const char *const names[FLASH_STAT_OPS] = { "READ", "PROGRAM", "SECTOR ERASE", "BULK ERASE" };
+  flash_op_stats_t *op;
+  uint8_t i;
+
+  for (i = 0; i < FLASH_STAT_OPS; i++) {
+    op = &_stats.op[i];
+    out.print(names[i]);
+    out.print(F(": count "));
+    out.print(op->count);
+    out.print(F(", bytes "));
+    out.print(op->bytes);
+    if (op->count > 0) {
+      out.print(F(", us min/avg/max "));
+      out.print(op->min_us);
+      out.print('/');
+      out.print(op->total_us / op->count);
+      out.print('/');
+      out.print(op->max_us);
+    }
+    out.println();
+  }
+  out.print(F("commands "));
+  out.print(_stats.cs_pairs);
+  out.print(F(", WIP wait us "));
+  out.println(_stats.wait_us);
+#else
+  (void)out;
+#endif
+}
+/**
+   @brief Dump Trace.
+   @details
+   Prints the last SPIFLASH_TRACE_LEN commands, oldest first: time in us, command code, address and byte count.
+   flash_wait_ready() is logged as one READ STATUS REGISTER whose count is the number of status bytes polled;
+   the status reads of flash_busy() and flash_read_status_register() are not logged.
+*/
+void SPIFlash::flash_trace_dump(Print &out)
+{
+#if SPIFLASH_TRACE_LEN > 0
+  flash_trace_entry_t *e;
+  uint16_t i;
+
+  for (i = 0; i < _trace_count; i++) {
+    e = &_trace[(_trace_next + SPIFLASH_TRACE_LEN - _trace_count + i) % SPIFLASH_TRACE_LEN];
+    out.print(e->time_us);
+    out.print(F(" "));
+    out.print(e->cmd, HEX);
+    out.print(F(" "));
+    out.print(e->addr, HEX);
+    out.print(F(" "));
+    out.println(e->len);
+  }
+#else
+  (void)out;
+#endif
+}
+#endif
+#if SPIFLASH_STATS
+uint32_t SPIFlash::flash_stats_now(void)
+{
+  return _bus->now_us();
+}
+/**
+   Counts one operation of op moving bytes bytes; its latency runs from start (flash_stats_now()) to now
+   unless start is FLASH_STATS_NO_LATENCY.
+*/
+void SPIFlash::flash_stats_sample(uint8_t op, uint32_t bytes, uint32_t start)
+{
+  flash_op_stats_t *s = &_stats.op[op];
+  uint32_t us;
+  if (bytes != FLASH_STATS_NO_COUNT) {
+    s->count++;
+    s->bytes += bytes;
+  }
+  if (start == FLASH_STATS_NO_LATENCY) {
+    return;
+  }
+  us = _bus->now_us() - start;
+  s->total_us += us;
+  if (us < s->min_us) {
+    s->min_us = us;
+  }
+  if (us > s->max_us) {
+    s->max_us = us;
+  }
+}
+/**
+   Starts timing the self-timed cycle of op; flash_stats_cycle_end() records it once WIP is seen at 0.
+*/
+void SPIFlash::flash_stats_cycle_start(uint8_t op, uint32_t bytes)
+{
+  flash_stats_sample(op, bytes, FLASH_STATS_NO_LATENCY);
+  _stats_cycle = op;
+  _stats_cycle_start = _bus->now_us();
+}
+void SPIFlash::flash_stats_cycle_end(void)
+{
+  if (_stats_cycle < FLASH_STAT_OPS) {
+    flash_stats_sample(_stats_cycle, FLASH_STATS_NO_COUNT, _stats_cycle_start);
+    _stats_cycle = FLASH_STAT_OPS;
+  }
+}
+#endif
+#if SPIFLASH_TRACE_LEN > 0
+void SPIFlash::flash_trace(uint8_t cmd, uint32_t addr, uint32_t len)
+{
+  flash_trace_entry_t *e = &_trace[_trace_next];
+  e->time_us = _bus->now_us();
+  e->cmd = cmd;
+  e->addr = addr;
+  e->len = len;
+  _trace_next = (_trace_next + 1) % SPIFLASH_TRACE_LEN;
+  if (_trace_count < SPIFLASH_TRACE_LEN) {
+    _trace_count++;
+  }
 }
+#endif
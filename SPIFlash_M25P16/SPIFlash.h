@@ -29,9 +29,8 @@
 #define _SPIFLASH_H_
 
 
-#include <Arduino.h>
-#include <SPI.h>
-#include <stdint.h>
+#include "SPIFlashTransport.h"
+#include "SPIFlashCRC.h"
 
 /// IMPORTANT: NAND FLASH memory requires erase before write, because
 ///            it can only transition from 1s to 0s and only the erase command can reset all 0s to 1s
@@ -61,6 +60,45 @@
 #define flash_SECTOR_COUNT     (32)
 #define flash_SECTOR_BYTE_SIZE (65536)
 
+/// Passed as the scratch sector of flash_smart_write() when no sector may be used for it.
+#define flash_NO_SCRATCH       (0xFFFFFFFFUL)
+
+/// Highest clock frequency (fR) at which READ DATA BYTES (0x03) may be issued.
+/// Above it the driver switches to READ DATA BYTES at HIGHER SPEED (0x0B).
+#define flash_READ_MAX_HZ      (20000000UL)
+
+/// Number of 256-byte pages kept in the RAM read cache in front of flash_read_data_bytes().
+/// 0 (the default) compiles the cache out. Reads larger than the cache bypass it.
+#ifndef SPIFLASH_CACHE_PAGES
+#define SPIFLASH_CACHE_PAGES   (0)
+#endif
+
+/// Erased-sector map (see flash_map_mount()): the reserved sector holds snapshots of 16 bytes,
+/// erased mask, free mask and their CRC-32, appended one after the other.
+#define FLASH_MAP_SLOT_SIZE    (16)
+#define FLASH_MAP_SLOTS        (flash_SECTOR_BYTE_SIZE / FLASH_MAP_SLOT_SIZE)
+
+/// S# HIGH to DEEP POWER-DOWN (tDP) and S# HIGH to STANDBY after RELEASE from DEEP POWER-DOWN (tRES), maximum values.
+#define flash_tDP_US           (3)
+#define flash_tRES_US          (30)
+
+/// Typical durations of the self-timed cycles: PAGE PROGRAM (of a full page), WRITE STATUS REGISTER, SECTOR ERASE and BULK ERASE.
+/// flash_wait_ready() passes what is left of them to SPIFlashTransport::wait_ready() as a hint.
+#define flash_tPP_US           (640UL)
+#define flash_tW_US            (1300UL)
+#define flash_tSE_US           (600000UL)
+#define flash_tBE_US           (13000000UL)
+
+/// 1 compiles in the per-command counters read by flash_get_stats(). 0 (the default) leaves no code or data behind.
+#ifndef SPIFLASH_STATS
+#define SPIFLASH_STATS         (0)
+#endif
+
+/// Number of entries of the ring buffer of recent commands dumped by flash_trace_dump(). 0 (the default) compiles it out.
+#ifndef SPIFLASH_TRACE_LEN
+#define SPIFLASH_TRACE_LEN     (0)
+#endif
+
 /**
    @brief Write Protect.
    @details
@@ -129,9 +167,6 @@
 #define FLASH_SREG_WRITE_IN_PROGRESS(SREG)     ((SREG) & (1 << 0))
 
 
-#define SPI_ASSERT()   digitalWrite(_cspin, LOW);
-#define SPI_DEASSERT()  digitalWrite(_cspin, HIGH);
-
 typedef struct flash_identification {
   uint8_t manufacturer;
   uint8_t memory_type;
@@ -139,29 +174,193 @@ typedef struct flash_identification {
   uint8_t cfd_length;
   uint8_t cfd_content[16];
 } flash_identification_t;
+
+typedef struct flash_cache_stats {
+  uint32_t hits;
+  uint32_t misses;
+} flash_cache_stats_t;
+
+/// Indexes of flash_stats_t::op.
+#define FLASH_STAT_READ          (0)
+#define FLASH_STAT_PROGRAM       (1)
+#define FLASH_STAT_SECTOR_ERASE  (2)
+#define FLASH_STAT_BULK_ERASE    (3)
+#define FLASH_STAT_OPS           (4)
+
+/// Average latency is total_us / count. min_us is FFFFFFFFh until the first sample.
+typedef struct flash_op_stats {
+  uint32_t count;
+  uint32_t bytes;
+  uint32_t total_us;
+  uint32_t min_us;
+  uint32_t max_us;
+} flash_op_stats_t;
+
+typedef struct flash_stats {
+  flash_op_stats_t op[FLASH_STAT_OPS];
+  uint32_t cs_pairs;   // S# LOW/HIGH pairs, i.e. commands sent
+  uint32_t wait_us;    // time spent in flash_wait_ready()
+} flash_stats_t;
+
+typedef struct flash_trace_entry {
+  uint32_t time_us;
+  uint32_t addr;
+  uint32_t len;
+  uint8_t cmd;
+} flash_trace_entry_t;
+
 class SPIFlash {
   public:
-    SPIFlash(uint8_t cspin);
-    void SPIset();
+#ifdef ARDUINO
+    SPIFlash(uint8_t cspin, uint32_t clockHz = flash_CLOCK_MAX_HZ);
+#endif
+    SPIFlash(SPIFlashTransport &transport);
+    bool SPIset();
+    bool flash_bus_ok(void);
     void flash_write_enable(void);
     void flash_write_disable(void);
     void flash_read_identification(struct flash_identification *p);
     void flash_read_status_register(uint8_t *sreg);
     void flash_write_status_register(uint8_t sreg);
     void flash_read_data_bytes(uint32_t addr, uint8_t *buf, uint32_t siz);
-    void flash_page_program(uint32_t addr, uint8_t *buf, uint32_t siz);
-    void flash_sector_erase(uint32_t addr);
-    void flash_bulk_erase(void);
+    void flash_fast_read_data_bytes(uint32_t addr, uint8_t *buf, uint32_t siz);
+    void flash_stream_read(uint32_t addr, uint8_t *buf, uint32_t siz);
+    void flash_stream_end(void);
+    bool flash_page_program(uint32_t addr, const uint8_t *buf, uint32_t siz);
+    void flash_write(uint32_t addr, const uint8_t *buf, uint32_t len);
+    uint32_t flash_write_crc(uint32_t addr, const uint8_t *buf, uint32_t len);
+    uint32_t flash_crc32(uint32_t addr, uint32_t len);
+    bool flash_verify(uint32_t addr, uint32_t expected_crc, uint32_t len);
+    bool flash_smart_write(uint32_t addr, const uint8_t *buf, uint32_t len, uint32_t scratch = flash_NO_SCRATCH);
+    bool flash_busy(void);
+    void flash_wait_ready(void);
+    bool flash_sector_erase(uint32_t addr);
+    bool flash_bulk_erase(void);
     void flash_deep_power_down(void);
     void flash_release_from_deep_power_down(void);
+    void flash_set_auto_power_down(uint32_t idle_us);
+    bool flash_idle(void);
+    uint32_t flash_now_us(void);
+    bool flash_map_mount(uint8_t map_sector);
+    void flash_sector_free(uint8_t sector);
+    bool flash_sector_is_erased(uint8_t sector);
+    int8_t flash_find_erased_sector(void);
+    void flash_set_erase_ahead(bool on);
+    void flash_cache_invalidate(void);
+    void flash_cache_get_stats(flash_cache_stats_t *stats);
+    void flash_cache_reset_stats(void);
+    void flash_get_stats(flash_stats_t *stats);
+    void flash_reset_stats(void);
+#ifdef ARDUINO
+    void flash_stats_dump(Print &out);
+    void flash_trace_dump(Print &out);
+#endif
   protected:
+    bool flash_init(void);
+    uint8_t flash_send_enabled(const flash_xfer_t *cmd);
+    bool flash_accepts(uint8_t sreg, uint32_t addr);
+    void flash_cycle_expect(uint32_t typ_us);
+    void flash_exec(const flash_xfer_t *xfers, uint8_t count);
+    void flash_wake(void);
+    void flash_mark_active(void);
+    void flash_power_delay(uint32_t us);
+    bool flash_map_task(void);
+    void flash_map_store(void);
+    void flash_map_use(uint32_t addr);
+    void flash_map_erasing(uint32_t addr);
+    void flash_map_settle(void);
+    bool flash_map_read_slot(uint16_t slot, uint32_t *erased, uint32_t *free_mask);
+    static void flash_xfer_set(flash_xfer_t *x, uint8_t cmd, uint32_t addr, uint8_t hdr_len);
+    void flash_read_array(uint32_t addr, uint8_t *buf, uint32_t siz);
+    void flash_program(uint32_t addr, const uint8_t *buf, uint32_t len, uint32_t *crc);
+    void flash_cache_invalidate_page(uint16_t page);
+    void flash_cache_invalidate_sector(uint8_t sector);
+    bool flash_needs_erase(uint32_t addr, const uint8_t *buf, uint32_t len);
+    void flash_program_changed(uint32_t addr, const uint8_t *buf, uint32_t len);
+    void flash_rewrite_sector(uint32_t addr, const uint8_t *buf, uint32_t len, uint32_t scratch);
+    void flash_overlay_page(uint32_t page, uint8_t *data, uint32_t addr, const uint8_t *buf, uint32_t len);
+    void flash_erase_and_wait(uint32_t addr);
+    uint32_t flash_stats_now(void);
+    void flash_stats_sample(uint8_t op, uint32_t bytes, uint32_t start);
+    void flash_stats_cycle_start(uint8_t op, uint32_t bytes);
+    void flash_stats_cycle_end(void);
+    void flash_trace(uint8_t cmd, uint32_t addr, uint32_t len);
 
     uint16_t lastPage;
     uint32_t pointer;
     uint16_t _pagesize;
     uint32_t _highestaddr;
-    uint8_t _cspin;
+#ifdef ARDUINO
+    SPIFlashSPI _spi;
+#endif
+    SPIFlashTransport *_bus;
+    bool _bus_ok;                 // result of the last SPIset()
+    uint32_t _cycle_at;           // when the last PROGRAM, ERASE or WRITE cycle was started
+    uint32_t _cycle_us;           // its typical duration, 0 when no cycle is known to be in progress
+    uint8_t _power;               // FLASH_POWER_STANDBY, FLASH_POWER_DOWN or FLASH_POWER_WAKING
+    uint32_t _power_at;           // when the last DEEP POWER-DOWN or RELEASE from DEEP POWER-DOWN was sent
+    uint32_t _idle_us;            // 0 when auto power-down is off
+    uint32_t _last_us;            // end of the last command, kept only while auto power-down is on
+    uint8_t _map_sector;          // flash_SECTOR_COUNT while the erased-sector map is off
+    uint16_t _map_slot;           // next unwritten snapshot slot, FLASH_MAP_SLOTS when the sector must be erased first
+    uint32_t _map_erased;         // bit n: sector n is known to be erased
+    uint32_t _map_free;           // bit n: the contents of sector n are no longer needed
+    uint32_t _map_stored_erased;  // masks of the last snapshot written to the map sector
+    uint32_t _map_stored_free;
+    uint32_t _map_erasing;        // sectors of the erase in progress, erased once WIP clears
+    bool _erase_ahead;
+    bool _stream_open;            // a READ of flash_stream_read() holds S# LOW
+    uint32_t _stream_addr;        // next address of that READ
+#if SPIFLASH_CACHE_PAGES > 0
+    uint8_t _cache_data[SPIFLASH_CACHE_PAGES][flash_PAGE_BYTE_SIZE];
+    uint16_t _cache_page[SPIFLASH_CACHE_PAGES];  // flash_PAGE_COUNT when the slot is empty
+    uint8_t _cache_ref[SPIFLASH_CACHE_PAGES];
+    uint8_t _cache_hand;
+    flash_cache_stats_t _cache_stats;
+#endif
+#if SPIFLASH_STATS
+    flash_stats_t _stats;
+    uint8_t _stats_cycle;         // FLASH_STAT_OPS when no self-timed cycle is being timed
+    uint32_t _stats_cycle_start;
+#endif
+#if SPIFLASH_TRACE_LEN > 0
+    flash_trace_entry_t _trace[SPIFLASH_TRACE_LEN];
+    uint16_t _trace_next;
+    uint16_t _trace_count;
+#endif
 
 };
 
+#if !SPIFLASH_STATS
+/**
+   Without SPIFLASH_STATS the hooks are empty and compile away at every call site.
+*/
+inline uint32_t SPIFlash::flash_stats_now(void)
+{
+  return 0;
+}
+inline void SPIFlash::flash_stats_sample(uint8_t op, uint32_t bytes, uint32_t start)
+{
+  (void)op;
+  (void)bytes;
+  (void)start;
+}
+inline void SPIFlash::flash_stats_cycle_start(uint8_t op, uint32_t bytes)
+{
+  (void)op;
+  (void)bytes;
+}
+inline void SPIFlash::flash_stats_cycle_end(void)
+{
+}
+#endif
+#if SPIFLASH_TRACE_LEN == 0
+inline void SPIFlash::flash_trace(uint8_t cmd, uint32_t addr, uint32_t len)
+{
+  (void)cmd;
+  (void)addr;
+  (void)len;
+}
+#endif
+
 #endif
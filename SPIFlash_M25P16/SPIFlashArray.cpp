@@ -0,0 +1,191 @@
+// * Copyright (c) 2013 Shinichiro Nakamura (https://github.com/shintamainjp)
+// > Updated April. 7, 2016, George KC,Arduino version. (https://github.com/georgekc)
+// **********************************************************************************
+// License
+// **********************************************************************************
+// This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software
+// Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will
+// be useful, but WITHOUT ANY WARRANTY; without even the
+// implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public
+// License for more details.
+//
+// You should have received a copy of the GNU General
+// Public License along with this program.
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Licence can be viewed at
+// http://www.gnu.org/licenses/gpl-3.0.txt
+//
+// Please maintain this license information along with authorship
+// and copyright notices in any redistribution of this code
+
+
+#include "SPIFlashArray.h"
+
+SPIFlashArray::SPIFlashArray(SPIFlash *const *chips, uint8_t count)
+{
+  uint8_t i;
+  if (chips == NULL) {
+    count = 0;
+  }
+  if (count > SPIFLASH_ARRAY_MAX_CHIPS) {
+    count = SPIFLASH_ARRAY_MAX_CHIPS;
+  }
+  for (i = 0; i < count && chips[i] != NULL; i++) {
+    _chips[i] = chips[i];
+  }
+  _count = i;  // 0 (no devices) leaves an array of size() 0 on which read() and write() do nothing
+}
+/**
+   @brief Read.
+   @details
+   Reads len bytes at addr, one READ per page. Waits for a device that is still busy before reading from it.
+*/
+void SPIFlashArray::read(uint32_t addr, uint8_t *buf, uint32_t len)
+{
+  SPIFlash *flash;
+  uint32_t local;
+  uint32_t chunk;
+
+  if (_count == 0) {
+    return;
+  }
+  while (len > 0) {
+    chunk = flash_PAGE_BYTE_SIZE - (addr % flash_PAGE_BYTE_SIZE);
+    if (chunk > len) {
+      chunk = len;
+    }
+    flash = chip(addr, &local);
+    flash->flash_wait_ready();
+    flash->flash_read_data_bytes(local, buf, chunk);
+    addr += chunk;
+    buf += chunk;
+    len -= chunk;
+  }
+}
+/**
+   @brief Write.
+   @details
+   Programs len bytes at addr, which must have been erased, page by page. Each device takes its own pages
+   in address order, but the devices are served round-robin: a busy one is skipped for the next idle one,
+   so the only wait is for all of them at once. Returns once every device has finished.
+*/
+void SPIFlashArray::write(uint32_t addr, const uint8_t *buf, uint32_t len)
+{
+  uint32_t next[SPIFLASH_ARRAY_MAX_CHIPS];  // next address to program on each device, end once done
+  uint32_t end = addr + len;
+  uint32_t page;
+  uint32_t local;
+  uint32_t chunk;
+  uint8_t left = 0;
+  uint8_t i;
+  SPIFlash *flash;
+
+  if (_count == 0) {
+    return;
+  }
+  for (i = 0; i < _count; i++) {
+    next[i] = end;
+  }
+  page = addr - (addr % flash_PAGE_BYTE_SIZE);
+  for (i = 0; i < _count && page + (uint32_t)i * flash_PAGE_BYTE_SIZE < end; i++) {
+    next[(page / flash_PAGE_BYTE_SIZE + i) % _count] = (i == 0) ? addr : page + (uint32_t)i * flash_PAGE_BYTE_SIZE;
+    left++;
+  }
+  i = (page / flash_PAGE_BYTE_SIZE) % _count;
+  while (left > 0) {
+    if (next[i] < end) {
+      flash = chip(next[i], &local);
+      if (!flash->flash_busy()) {
+        chunk = flash_PAGE_BYTE_SIZE - (next[i] % flash_PAGE_BYTE_SIZE);
+        if (chunk > end - next[i]) {
+          chunk = end - next[i];
+        }
+        flash->flash_page_program(local, buf + (next[i] - addr), chunk);
+        next[i] += chunk + (uint32_t)(_count - 1) * flash_PAGE_BYTE_SIZE;
+        if (next[i] >= end) {
+          next[i] = end;
+          left--;
+        }
+      }
+    }
+    i = (i + 1) % _count;
+  }
+  wait_ready();
+}
+/**
+   @brief Erase Sector.
+   @details
+   Erases sector (0 to flash_SECTOR_COUNT - 1) of every device, in parallel, and waits for all of them.
+*/
+void SPIFlashArray::erase_sector(uint8_t sector)
+{
+  uint8_t i;
+  wait_ready();
+  for (i = 0; i < _count; i++) {
+    _chips[i]->flash_sector_erase((uint32_t)sector * flash_SECTOR_BYTE_SIZE);
+  }
+  wait_ready();
+}
+/**
+   @brief Bulk Erase.
+   @details
+   Erases every device, in parallel, and waits for all of them.
+*/
+void SPIFlashArray::bulk_erase(void)
+{
+  uint8_t i;
+  wait_ready();
+  for (i = 0; i < _count; i++) {
+    _chips[i]->flash_bulk_erase();
+  }
+  wait_ready();
+}
+/**
+   @brief Busy.
+   @details
+   Returns true while any device has a cycle in progress.
+*/
+bool SPIFlashArray::busy(void)
+{
+  uint8_t i;
+  for (i = 0; i < _count; i++) {
+    if (_chips[i]->flash_busy()) {
+      return true;
+    }
+  }
+  return false;
+}
+void SPIFlashArray::wait_ready(void)
+{
+  uint8_t i;
+  for (i = 0; i < _count; i++) {
+    _chips[i]->flash_wait_ready();
+  }
+}
+/**
+   Capacity of the array in bytes.
+*/
+uint32_t SPIFlashArray::size(void)
+{
+  return (uint32_t)_count * flash_SECTOR_COUNT * flash_SECTOR_BYTE_SIZE;
+}
+uint32_t SPIFlashArray::sector_size(void)
+{
+  return (uint32_t)_count * flash_SECTOR_BYTE_SIZE;
+}
+/**
+   Device holding addr, and the address on that device.
+*/
+SPIFlash *SPIFlashArray::chip(uint32_t addr, uint32_t *local)
+{
+  uint32_t page = addr / flash_PAGE_BYTE_SIZE;
+  *local = (page / _count) * flash_PAGE_BYTE_SIZE + (addr % flash_PAGE_BYTE_SIZE);
+  return _chips[page % _count];
+}
@@ -0,0 +1,68 @@
+// * Copyright (c) 2013 Shinichiro Nakamura (https://github.com/shintamainjp)
+// > Updated April. 7, 2016, George KC, Arduino version. (https://github.com/georgekc)
+// **********************************************************************************
+// License
+// **********************************************************************************
+// This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software
+// Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will
+// be useful, but WITHOUT ANY WARRANTY; without even the
+// implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public
+// License for more details.
+//
+// You should have received a copy of the GNU General
+// Public License along with this program.
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Licence can be viewed at
+// http://www.gnu.org/licenses/gpl-3.0.txt
+//
+// Please maintain this license information along with authorship
+// and copyright notices in any redistribution of this code
+
+
+#ifndef _SPIFLASH_ARRAY_H_
+#define _SPIFLASH_ARRAY_H_
+
+
+#include "SPIFlash.h"
+
+/// Largest number of devices in one array.
+#ifndef SPIFLASH_ARRAY_MAX_CHIPS
+#define SPIFLASH_ARRAY_MAX_CHIPS (8)
+#endif
+
+/**
+   @brief Several M25P16, each on its own chip select, seen as one address space.
+   @details
+   Pages are striped: page p of the array is page p / count of device p % count, so consecutive pages
+   sit on different devices. write() starts each PAGE PROGRAM as soon as its device is idle, without waiting
+   for the others, so up to count self-timed cycles run at the same time. erase_sector() and bulk_erase()
+   start the erase on every device before waiting for any of them.
+   A sector of the array is the same sector of every device: count * 64 KB.
+*/
+class SPIFlashArray {
+  public:
+    SPIFlashArray(SPIFlash *const *chips, uint8_t count);
+    void read(uint32_t addr, uint8_t *buf, uint32_t len);
+    void write(uint32_t addr, const uint8_t *buf, uint32_t len);
+    void erase_sector(uint8_t sector);
+    void bulk_erase(void);
+    bool busy(void);
+    void wait_ready(void);
+    uint32_t size(void);
+    uint32_t sector_size(void);
+  protected:
+    SPIFlash *chip(uint32_t addr, uint32_t *local);
+
+    SPIFlash *_chips[SPIFLASH_ARRAY_MAX_CHIPS];
+    uint8_t _count;
+
+};
+
+#endif
@@ -0,0 +1,212 @@
+// * Copyright (c) 2013 Shinichiro Nakamura (https://github.com/shintamainjp)
+// > Updated April. 7, 2016, George KC,Arduino version. (https://github.com/georgekc)
+// **********************************************************************************
+// License
+// **********************************************************************************
+// This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software
+// Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will
+// be useful, but WITHOUT ANY WARRANTY; without even the
+// implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public
+// License for more details.
+//
+// You should have received a copy of the GNU General
+// Public License along with this program.
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Licence can be viewed at
+// http://www.gnu.org/licenses/gpl-3.0.txt
+//
+// Please maintain this license information along with authorship
+// and copyright notices in any redistribution of this code
+
+#include "SPIFlashAsync.h"
+
+SPIFlashAsync::SPIFlashAsync(SPIFlash &flash) : _flash(flash)
+{
+  _head = 0;
+  _count = 0;
+  _running = false;
+  _next = FLASH_HANDLE_NONE;
+  _failed = 0;
+}
+/**
+   @brief Submit Sector Erase.
+   @details
+   Queues a SECTOR ERASE of the sector containing addr.
+   Returns FLASH_HANDLE_NONE if the queue is full.
+*/
+flash_handle_t SPIFlashAsync::sector_erase(uint32_t addr, flash_completion_t cb, void *ctx)
+{
+  return submit(FLASH_ASYNC_SECTOR_ERASE, addr, NULL, 0, cb, ctx);
+}
+/**
+   @brief Submit Bulk Erase.
+   @details
+   Queues a BULK ERASE. Returns FLASH_HANDLE_NONE if the queue is full.
+*/
+flash_handle_t SPIFlashAsync::bulk_erase(flash_completion_t cb, void *ctx)
+{
+  return submit(FLASH_ASYNC_BULK_ERASE, 0, NULL, 0, cb, ctx);
+}
+/**
+   @brief Submit Program.
+   @details
+   Queues a program of len bytes at addr. The range is split on page boundaries
+   like flash_write(), one PAGE PROGRAM per poll() that finds the device idle.
+   Returns FLASH_HANDLE_NONE if the queue is full.
+*/
+flash_handle_t SPIFlashAsync::program(uint32_t addr, const uint8_t *buf, uint32_t len,
+                                      flash_completion_t cb, void *ctx)
+{
+  return submit(FLASH_ASYNC_PROGRAM, addr, buf, len, cb, ctx);
+}
+/**
+   @brief Poll.
+   @details
+   Advances the engine without blocking and runs the completion callbacks of finished operations.
+   Returns true while operations are still queued or running.
+*/
+bool SPIFlashAsync::poll(void)
+{
+  flash_async_op_t *op;
+
+  if (_count == 0) {
+    return false;
+  }
+  if (_flash.flash_busy()) {
+    return true;  // our own cycle, or one the caller started: nothing may be sent until it ends
+  }
+  op = &_queue[_head];
+  if (_running) {
+    if (op->type == FLASH_ASYNC_PROGRAM && op->len > 0) {
+      if (start(op)) {
+        return true;
+      }
+      _failed++;
+    }
+    finish(op);
+  }
+  // A refused command leaves the device idle, so the next operation can start right away.
+  while (_count > 0 && !_running) {
+    op = &_queue[_head];
+    if (!start(op)) {
+      _failed++;
+      finish(op);
+    }
+  }
+  return _count > 0;
+}
+/**
+   @brief Pending.
+   @details
+   Returns true while the operation identified by handle is queued or running.
+*/
+bool SPIFlashAsync::pending(flash_handle_t handle)
+{
+  uint8_t i;
+  for (i = 0; i < _count; i++) {
+    if (_queue[(_head + i) % SPIFLASH_ASYNC_QUEUE_LEN].handle == handle) {
+      return true;
+    }
+  }
+  return false;
+}
+/**
+   @brief Idle.
+   @details
+   Returns true when no operation is queued or running.
+*/
+bool SPIFlashAsync::idle(void)
+{
+  return _count == 0;
+}
+/**
+   @brief Failed.
+   @details
+   Number of operations the device refused since construction. Read it from a completion callback
+   to tell whether the operation being completed failed.
+*/
+uint16_t SPIFlashAsync::failed(void)
+{
+  return _failed;
+}
+flash_handle_t SPIFlashAsync::submit(uint8_t type, uint32_t addr, const uint8_t *buf, uint32_t len,
+                                     flash_completion_t cb, void *ctx)
+{
+  flash_async_op_t *op;
+
+  if (_count == SPIFLASH_ASYNC_QUEUE_LEN) {
+    return FLASH_HANDLE_NONE;
+  }
+  if (++_next == FLASH_HANDLE_NONE) {
+    _next++;
+  }
+  op = &_queue[(_head + _count) % SPIFLASH_ASYNC_QUEUE_LEN];
+  op->handle = _next;
+  op->type = type;
+  op->addr = addr;
+  op->buf = buf;
+  op->len = len;
+  op->cb = cb;
+  op->ctx = ctx;
+  _count++;
+  if (!_running) {
+    poll();
+  }
+  return op->handle;
+}
+/**
+   Issues the next cycle of op: WRITE ENABLE followed by the erase command or by one page of the program.
+   The device must not be busy. Returns false, leaving nothing running, if the device refused the command.
+*/
+bool SPIFlashAsync::start(flash_async_op_t *op)
+{
+  uint32_t chunk;
+  bool ok = true;
+
+  switch (op->type) {
+    case FLASH_ASYNC_SECTOR_ERASE:
+      ok = _flash.flash_sector_erase(op->addr);
+      break;
+    case FLASH_ASYNC_BULK_ERASE:
+      ok = _flash.flash_bulk_erase();
+      break;
+    case FLASH_ASYNC_PROGRAM:
+      if (op->len == 0) {
+        break;
+      }
+      chunk = flash_PAGE_BYTE_SIZE - (op->addr % flash_PAGE_BYTE_SIZE);
+      if (chunk > op->len) {
+        chunk = op->len;
+      }
+      ok = _flash.flash_page_program(op->addr, op->buf, chunk);
+      op->addr += chunk;
+      op->buf += chunk;
+      op->len -= chunk;
+      break;
+  }
+  _running = ok;
+  return ok;
+}
+/**
+   Removes op, the head of the queue, and runs its callback.
+*/
+void SPIFlashAsync::finish(flash_async_op_t *op)
+{
+  flash_handle_t handle = op->handle;
+  flash_completion_t cb = op->cb;
+  void *ctx = op->ctx;
+
+  _head = (_head + 1) % SPIFLASH_ASYNC_QUEUE_LEN;
+  _count--;
+  _running = false;
+  if (cb != NULL) {
+    cb(handle, ctx);
+  }
+}
@@ -0,0 +1,99 @@
+// * Copyright (c) 2013 Shinichiro Nakamura (https://github.com/shintamainjp)
+// > Updated April. 7, 2016, George KC, Arduino version. (https://github.com/georgekc)
+// **********************************************************************************
+// License
+// **********************************************************************************
+// This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software
+// Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will
+// be useful, but WITHOUT ANY WARRANTY; without even the
+// implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public
+// License for more details.
+//
+// You should have received a copy of the GNU General
+// Public License along with this program.
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Licence can be viewed at
+// http://www.gnu.org/licenses/gpl-3.0.txt
+//
+// Please maintain this license information along with authorship
+// and copyright notices in any redistribution of this code
+
+#ifndef _SPIFLASH_ASYNC_H_
+#define _SPIFLASH_ASYNC_H_
+
+
+#include "SPIFlash.h"
+
+/// Number of erase/program operations that can be queued at once.
+#ifndef SPIFLASH_ASYNC_QUEUE_LEN
+#define SPIFLASH_ASYNC_QUEUE_LEN (4)
+#endif
+
+#define FLASH_ASYNC_SECTOR_ERASE (1)
+#define FLASH_ASYNC_BULK_ERASE   (2)
+#define FLASH_ASYNC_PROGRAM      (3)
+
+/// Handle returned when an operation is submitted. 0 is never a valid handle.
+typedef uint16_t flash_handle_t;
+#define FLASH_HANDLE_NONE (0)
+
+/// Called from poll() once the self-timed cycle of an operation has completed.
+typedef void (*flash_completion_t)(flash_handle_t handle, void *ctx);
+
+typedef struct flash_async_op {
+  flash_handle_t handle;
+  uint8_t type;
+  uint32_t addr;
+  const uint8_t *buf;
+  uint32_t len;
+  flash_completion_t cb;
+  void *ctx;
+} flash_async_op_t;
+
+/**
+   @brief Non-blocking erase/program engine.
+   @details
+   Operations are queued and started one after the other; poll() must be called
+   regularly (e.g. from loop()). Each call reads the status register once and,
+   if WIP is 0, either issues the next page of a program, completes the current
+   operation, or starts the next queued one. It never waits for a cycle to end.
+   Buffers passed to program() must stay valid until the operation completes.
+   No other command may be sent to the device while an operation is running.
+   An operation the device refuses (WEL not set or a protected area) ends at once, the rest of a program
+   included; its callback still runs, and failed() counts it.
+*/
+class SPIFlashAsync {
+  public:
+    SPIFlashAsync(SPIFlash &flash);
+    flash_handle_t sector_erase(uint32_t addr, flash_completion_t cb = NULL, void *ctx = NULL);
+    flash_handle_t bulk_erase(flash_completion_t cb = NULL, void *ctx = NULL);
+    flash_handle_t program(uint32_t addr, const uint8_t *buf, uint32_t len,
+                           flash_completion_t cb = NULL, void *ctx = NULL);
+    bool poll(void);
+    bool pending(flash_handle_t handle);
+    bool idle(void);
+    uint16_t failed(void);
+  protected:
+    flash_handle_t submit(uint8_t type, uint32_t addr, const uint8_t *buf, uint32_t len,
+                          flash_completion_t cb, void *ctx);
+    bool start(flash_async_op_t *op);
+    void finish(flash_async_op_t *op);
+
+    SPIFlash &_flash;
+    flash_async_op_t _queue[SPIFLASH_ASYNC_QUEUE_LEN];
+    uint8_t _head;
+    uint8_t _count;
+    bool _running;
+    flash_handle_t _next;
+    uint16_t _failed;
+
+};
+
+#endif
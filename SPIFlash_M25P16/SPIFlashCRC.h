@@ -0,0 +1,57 @@
+// * Copyright (c) 2013 Shinichiro Nakamura (https://github.com/shintamainjp)
+// > Updated April. 7, 2016, George KC, Arduino version. (https://github.com/georgekc)
+// **********************************************************************************
+// License
+// **********************************************************************************
+// This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software
+// Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will
+// be useful, but WITHOUT ANY WARRANTY; without even the
+// implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public
+// License for more details.
+//
+// You should have received a copy of the GNU General
+// Public License along with this program.
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Licence can be viewed at
+// http://www.gnu.org/licenses/gpl-3.0.txt
+//
+// Please maintain this license information along with authorship
+// and copyright notices in any redistribution of this code
+
+
+#ifndef _SPIFLASH_CRC_H_
+#define _SPIFLASH_CRC_H_
+
+
+#include <stdint.h>
+
+/// Lookup tables of the CRC-32: 0 uses a 16-entry nibble table (64 bytes), 1 a 256-entry byte table (1 KB),
+/// both constant (in PROGMEM on AVR); 4 or 8 slicing-by-4/8 builds 4 or 8 KB in RAM on first use, so it is opt-in on MCUs.
+#ifndef SPIFLASH_CRC_SLICES
+#if defined(__AVR__)
+#define SPIFLASH_CRC_SLICES (0)
+#elif defined(__linux__)
+#define SPIFLASH_CRC_SLICES (8)
+#else
+#define SPIFLASH_CRC_SLICES (1)
+#endif
+#endif
+
+#if SPIFLASH_CRC_SLICES != 0 && SPIFLASH_CRC_SLICES != 1 && SPIFLASH_CRC_SLICES != 4 && SPIFLASH_CRC_SLICES != 8
+#error "SPIFLASH_CRC_SLICES must be 0, 1, 4 or 8"
+#endif
+
+/// CRC-32 (IEEE 802.3, reflected, as zlib) of len bytes appended to data whose CRC is crc (0 to start).
+uint32_t flash_crc32_update(uint32_t crc, const uint8_t *data, uint32_t len);
+
+/// Fletcher-16 (sums modulo 255) of len bytes appended to data whose checksum is sum (0 to start).
+uint16_t flash_fletcher16_update(uint16_t sum, const uint8_t *data, uint32_t len);
+
+#endif
@@ -0,0 +1,386 @@
+// * Copyright (c) 2013 Shinichiro Nakamura (https://github.com/shintamainjp)
+// > Updated April. 7, 2016, George KC,Arduino version. (https://github.com/georgekc)
+// **********************************************************************************
+// License
+// **********************************************************************************
+// This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software
+// Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will
+// be useful, but WITHOUT ANY WARRANTY; without even the
+// implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public
+// License for more details.
+//
+// You should have received a copy of the GNU General
+// Public License along with this program.
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Licence can be viewed at
+// http://www.gnu.org/licenses/gpl-3.0.txt
+//
+// Please maintain this license information along with authorship
+// and copyright notices in any redistribution of this code
+
+#include "SPIFlashCompressed.h"
+
+SPIFlashCompressed::SPIFlashCompressed(SPIFlash &flash, uint8_t first, uint8_t count) : _flash(flash)
+{
+  _first = first;
+  _count = (count >= 2 && first + count <= flash_SECTOR_COUNT) ? count : 0;  // 0: invalid region
+  _fill = 0;
+  _comp_pos = 0;
+  _prog = 0;
+  _raw_pos = 0;
+  _slots = 0;
+  _indexed.raw_end = 0;
+  _indexed.comp_end = 0;
+  _npending = 0;
+  _src_i = 0;
+  _src_n = 0;
+  _src_pos = 0;
+  _src_end = 0;
+}
+/**
+   @brief Mount.
+   @details
+   Finds the end of the stored data. Returns false if the region holds neither a store nor blank sectors,
+   in which case format() must be called before write().
+*/
+bool SPIFlashCompressed::mount(void)
+{
+  uint8_t raw[FLASH_COMP_ENTRY];
+  uint32_t lo = 0;
+  uint32_t hi = FLASH_COMP_MAX_ENTRIES;
+  uint32_t mid;
+  uint32_t scan;
+  uint16_t n;
+  uint16_t i;
+  bool dirty = false;
+  flash_comp_entry_t gap;
+
+  if (_count == 0) {
+    return false;
+  }
+  _fill = 0;
+  _npending = 0;
+  // Entries are written from slot 0 on, so the used slots are a prefix of the index sector.
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    _flash.flash_read_data_bytes(index_addr(mid), raw, sizeof(raw));
+    for (i = 0; i < sizeof(raw) && raw[i] == 0xFF; i++) {
+    }
+    if (i < sizeof(raw)) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  _slots = lo;
+  if (!block_end(_slots, &_indexed) || _indexed.comp_end > data_size()) {
+    return false;
+  }
+  _raw_pos = _indexed.raw_end;
+  _comp_pos = _indexed.comp_end;
+  // Blocks programmed after the last index entry: resume on the first blank page after them.
+  for (scan = _comp_pos; scan < data_size(); ) {
+    n = flash_PAGE_BYTE_SIZE - scan % flash_PAGE_BYTE_SIZE;
+    _flash.flash_read_data_bytes(data_addr(scan), _page, n);
+    for (i = 0; i < n && _page[i] == 0xFF; i++) {
+    }
+    if (i == n) {
+      break;
+    }
+    dirty = true;
+    scan += n;
+  }
+  if (dirty) {
+    gap.raw_end = _raw_pos;
+    gap.comp_end = scan;
+    write_entries(&gap, 1);
+    _comp_pos = scan;
+  }
+  _prog = _comp_pos;
+  return true;
+}
+/**
+   @brief Format.
+   @details
+   Erases the whole region, leaving an empty store.
+*/
+void SPIFlashCompressed::format(void)
+{
+  uint8_t i;
+  if (_count == 0) {
+    return;
+  }
+  for (i = 0; i < _count; i++) {
+    _flash.flash_wait_ready();
+    _flash.flash_sector_erase((uint32_t)(_first + i) * flash_SECTOR_BYTE_SIZE);
+    _flash.flash_wait_ready();
+  }
+  _fill = 0;
+  _comp_pos = 0;
+  _prog = 0;
+  _raw_pos = 0;
+  _slots = 0;
+  _indexed.raw_end = 0;
+  _indexed.comp_end = 0;
+  _npending = 0;
+}
+/**
+   @brief Write.
+   @details
+   Appends len bytes. Returns false, storing only part of them, when the region is full.
+*/
+bool SPIFlashCompressed::write(const uint8_t *data, uint32_t len)
+{
+  uint32_t n;
+  if (_count == 0) {
+    return false;
+  }
+  while (len > 0) {
+    n = SPIFLASH_LZ_BLOCK - _fill;
+    if (n > len) {
+      n = len;
+    }
+    memcpy(&_block[_fill], data, n);
+    _fill += n;
+    data += n;
+    len -= n;
+    if (_fill == SPIFLASH_LZ_BLOCK && !compress_block()) {
+      return false;
+    }
+  }
+  return true;
+}
+/**
+   @brief Flush.
+   @details
+   Compresses the partial block, programs the partial page and writes the pending index entries,
+   so everything written so far can be read back and survives a power loss.
+   Returns false if the region is full.
+*/
+bool SPIFlashCompressed::flush(void)
+{
+  bool ok;
+  if (_count == 0) {
+    return false;
+  }
+  ok = _fill == 0 || compress_block();
+  program();
+  return ok;
+}
+/**
+   @brief Read.
+   @details
+   Copies up to len bytes of data starting at offset to buf, decompressing them,
+   and returns the number of bytes copied: fewer than len past the end of the flushed data.
+*/
+uint32_t SPIFlashCompressed::read(uint32_t offset, uint8_t *buf, uint32_t len)
+{
+  flash_comp_entry_t start;
+  flash_comp_entry_t stop;
+  uint32_t lo;
+  uint32_t hi;
+  uint32_t mid;
+  uint32_t n;
+  uint32_t got;
+  uint32_t done = 0;
+
+  while (done < len && offset < _indexed.raw_end) {
+    // First block ending past offset.
+    lo = 1;
+    hi = _slots;
+    while (lo < hi) {
+      mid = lo + (hi - lo) / 2;
+      block_end(mid, &stop);
+      if (stop.raw_end > offset) {
+        hi = mid;
+      } else {
+        lo = mid + 1;
+      }
+    }
+    block_end(lo - 1, &start);
+    block_end(lo, &stop);
+    n = stop.raw_end - offset;
+    if (n > len - done) {
+      n = len - done;
+    }
+    _src_pos = start.comp_end;
+    _src_end = stop.comp_end;
+    _src_i = 0;
+    _src_n = 0;
+    got = flash_lz_decompress(source, this, _window, offset - start.raw_end, buf + done, n);
+    done += got;
+    offset += got;
+    if (got < n) {
+      break;
+    }
+  }
+  _flash.flash_stream_end();
+  return done;
+}
+/**
+   @brief Size.
+   @details
+   Returns the number of bytes read() can return: the data up to the last index entry.
+*/
+uint32_t SPIFlashCompressed::size(void)
+{
+  return _indexed.raw_end;
+}
+/**
+   @brief Stored.
+   @details
+   Returns the number of compressed bytes those take on the device.
+*/
+uint32_t SPIFlashCompressed::stored(void)
+{
+  return _indexed.comp_end;
+}
+uint32_t SPIFlashCompressed::index_addr(uint32_t slot)
+{
+  return (uint32_t)_first * flash_SECTOR_BYTE_SIZE + slot * FLASH_COMP_ENTRY;
+}
+uint32_t SPIFlashCompressed::data_addr(uint32_t offset)
+{
+  return (uint32_t)(_first + 1) * flash_SECTOR_BYTE_SIZE + offset;
+}
+uint32_t SPIFlashCompressed::data_size(void)
+{
+  return (_count > 0) ? (uint32_t)(_count - 1) * flash_SECTOR_BYTE_SIZE : 0;
+}
+/**
+   Reads index entry slot. Returns false if it does not hold a valid entry.
+*/
+bool SPIFlashCompressed::read_entry(uint32_t slot, flash_comp_entry_t *e)
+{
+  uint8_t raw[FLASH_COMP_ENTRY];
+  _flash.flash_read_data_bytes(index_addr(slot), raw, sizeof(raw));
+  e->raw_end = (uint32_t)raw[0] | ((uint32_t)raw[1] << 8) | ((uint32_t)raw[2] << 16) | ((uint32_t)raw[3] << 24);
+  e->comp_end = (uint32_t)raw[4] | ((uint32_t)raw[5] << 8) | ((uint32_t)raw[6] << 16);
+  return raw[7] == (uint8_t)flash_crc32_update(0, raw, 7);
+}
+/**
+   Ends of the first blocks blocks. An entry torn by a power loss (at most one in a row)
+   counts as an empty block ending where the block before it does.
+   Returns false if neither the entry nor the one before it is valid.
+*/
+bool SPIFlashCompressed::block_end(uint32_t blocks, flash_comp_entry_t *e)
+{
+  if (blocks > 0 && read_entry(blocks - 1, e)) {
+    return true;
+  }
+  if (blocks > 1) {
+    return read_entry(blocks - 2, e);
+  }
+  e->raw_end = 0;
+  e->comp_end = 0;
+  return blocks == 0;
+}
+/**
+   Appends n index entries with a single write.
+*/
+void SPIFlashCompressed::write_entries(const flash_comp_entry_t *e, uint8_t n)
+{
+  uint8_t raw[FLASH_COMP_PENDING * FLASH_COMP_ENTRY];
+  uint8_t *p;
+  uint8_t i;
+
+  for (i = 0; i < n; i++) {
+    p = &raw[i * FLASH_COMP_ENTRY];
+    p[0] = e[i].raw_end;
+    p[1] = e[i].raw_end >> 8;
+    p[2] = e[i].raw_end >> 16;
+    p[3] = e[i].raw_end >> 24;
+    p[4] = e[i].comp_end;
+    p[5] = e[i].comp_end >> 8;
+    p[6] = e[i].comp_end >> 16;
+    p[7] = flash_crc32_update(0, p, 7);
+  }
+  _flash.flash_write(index_addr(_slots), raw, n * FLASH_COMP_ENTRY);
+  _slots += n;
+  _indexed = e[n - 1];
+}
+/**
+   Compresses _block into the page buffer and queues its index entry.
+   Returns false, keeping the block, when the compressed area or the index could be too small for it.
+*/
+bool SPIFlashCompressed::compress_block(void)
+{
+  if (_comp_pos + FLASH_LZ_BOUND(_fill) > data_size() ||
+      _slots + _npending + 2 > FLASH_COMP_MAX_ENTRIES) {
+    return false;
+  }
+  flash_lz_compress(_block, _fill, sink, this);
+  _raw_pos += _fill;
+  _fill = 0;
+  _pending[_npending].raw_end = _raw_pos;
+  _pending[_npending].comp_end = _comp_pos;
+  if (++_npending == FLASH_COMP_PENDING) {
+    program();
+  }
+  return true;
+}
+/**
+   Appends compressed bytes to the page buffer, programming each page as it fills up.
+*/
+void SPIFlashCompressed::put(const uint8_t *data, uint32_t len)
+{
+  uint32_t n;
+  while (len > 0) {
+    n = flash_PAGE_BYTE_SIZE - _comp_pos % flash_PAGE_BYTE_SIZE;
+    if (n > len) {
+      n = len;
+    }
+    memcpy(&_page[_comp_pos % flash_PAGE_BYTE_SIZE], data, n);
+    _comp_pos += n;
+    data += n;
+    len -= n;
+    if (_comp_pos % flash_PAGE_BYTE_SIZE == 0) {
+      program();
+    }
+  }
+}
+/**
+   Programs the compressed bytes of the page buffer not yet on the device, then the index entries
+   of the blocks now complete on the device.
+*/
+void SPIFlashCompressed::program(void)
+{
+  uint32_t n = _comp_pos - _prog;
+  if (n > 0) {
+    _flash.flash_write(data_addr(_prog), &_page[_prog % flash_PAGE_BYTE_SIZE], n);
+    _prog = _comp_pos;
+  }
+  if (_npending > 0) {
+    write_entries(_pending, _npending);
+    _npending = 0;
+  }
+}
+void SPIFlashCompressed::sink(void *ctx, const uint8_t *data, uint32_t len)
+{
+  ((SPIFlashCompressed *)ctx)->put(data, len);
+}
+/**
+   Next compressed byte of the block being decompressed, read ahead in small chunks
+   with flash_stream_read() so the whole block is one READ.
+*/
+int16_t SPIFlashCompressed::source(void *ctx)
+{
+  SPIFlashCompressed *s = (SPIFlashCompressed *)ctx;
+  if (s->_src_i == s->_src_n) {
+    if (s->_src_pos >= s->_src_end) {
+      return -1;
+    }
+    s->_src_n = (s->_src_end - s->_src_pos < sizeof(s->_src)) ? s->_src_end - s->_src_pos : sizeof(s->_src);
+    s->_flash.flash_stream_read(s->data_addr(s->_src_pos), s->_src, s->_src_n);
+    s->_src_pos += s->_src_n;
+    s->_src_i = 0;
+  }
+  return s->_src[s->_src_i++];
+}
@@ -0,0 +1,118 @@
+// * Copyright (c) 2013 Shinichiro Nakamura (https://github.com/shintamainjp)
+// > Updated April. 7, 2016, George KC, Arduino version. (https://github.com/georgekc)
+// **********************************************************************************
+// License
+// **********************************************************************************
+// This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software
+// Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will
+// be useful, but WITHOUT ANY WARRANTY; without even the
+// implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public
+// License for more details.
+//
+// You should have received a copy of the GNU General
+// Public License along with this program.
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Licence can be viewed at
+// http://www.gnu.org/licenses/gpl-3.0.txt
+//
+// Please maintain this license information along with authorship
+// and copyright notices in any redistribution of this code
+
+#ifndef _SPIFLASH_COMPRESSED_H_
+#define _SPIFLASH_COMPRESSED_H_
+
+
+#include "SPIFlash.h"
+#include "SPIFlashLZ.h"
+
+/// Bytes of data compressed as one block, the unit of random access of read().
+#ifndef SPIFLASH_LZ_BLOCK
+#if defined(__AVR__)
+#define SPIFLASH_LZ_BLOCK      (256)
+#else
+#define SPIFLASH_LZ_BLOCK      (1024)
+#endif
+#endif
+
+/// Compressed blocks waiting for their index entries; when they are all taken the partial page is programmed.
+#define FLASH_COMP_PENDING     (8)
+#define FLASH_COMP_ENTRY       (8)
+#define FLASH_COMP_MAX_ENTRIES (flash_SECTOR_BYTE_SIZE / FLASH_COMP_ENTRY)
+
+/// End of a block in the data (raw_end) and in the compressed area (comp_end), as stored in an index entry.
+typedef struct flash_comp_entry {
+  uint32_t raw_end;
+  uint32_t comp_end;
+} flash_comp_entry_t;
+
+/**
+   @brief Append-only store compressing its data with flash_lz_compress().
+   @details
+   Uses sectors [first, first + count) of the device: the first one holds the block index, the others
+   the compressed blocks, back to back. Data given to write() is collected in a block of SPIFLASH_LZ_BLOCK bytes;
+   each full block is compressed into a page buffer, and the device only sees whole-page PAGE PROGRAMs
+   of compressed data, so compressible data takes proportionally fewer page programs and bus bytes.
+
+   Every block has an 8-byte index entry: the end of the block in the data (4 bytes), its end in the
+   compressed area (3 bytes), and a check byte. Entries are written once the block is on the device,
+   so read() and mount() only ever see complete blocks; flush() pushes out the partial block and page.
+   mount() finds the last entry with a binary search of the index, and steps over the compressed bytes of
+   blocks that were programmed but not indexed when the power went down, recording the gap as an empty block.
+   read() looks the block up with a binary search too and decompresses it on the fly from a READ held open
+   across the block, keeping only the FLASH_LZ_WINDOW bytes of history in RAM.
+   The store needs count >= 2 sectors inside the device; with any other region mount(), write() and flush()
+   fail, and format() does nothing.
+*/
+class SPIFlashCompressed {
+  public:
+    SPIFlashCompressed(SPIFlash &flash, uint8_t first = 0, uint8_t count = flash_SECTOR_COUNT);
+    bool mount(void);
+    void format(void);
+    bool write(const uint8_t *data, uint32_t len);
+    bool flush(void);
+    uint32_t read(uint32_t offset, uint8_t *buf, uint32_t len);
+    uint32_t size(void);
+    uint32_t stored(void);
+  protected:
+    uint32_t index_addr(uint32_t slot);
+    uint32_t data_addr(uint32_t offset);
+    uint32_t data_size(void);
+    bool read_entry(uint32_t slot, flash_comp_entry_t *e);
+    bool block_end(uint32_t blocks, flash_comp_entry_t *e);
+    void write_entries(const flash_comp_entry_t *e, uint8_t n);
+    bool compress_block(void);
+    void put(const uint8_t *data, uint32_t len);
+    void program(void);
+    static void sink(void *ctx, const uint8_t *data, uint32_t len);
+    static int16_t source(void *ctx);
+
+    SPIFlash &_flash;
+    uint8_t _first;
+    uint8_t _count;
+    uint8_t _block[SPIFLASH_LZ_BLOCK];
+    uint16_t _fill;                   // bytes in _block
+    uint8_t _page[flash_PAGE_BYTE_SIZE];
+    uint32_t _comp_pos;               // end of the compressed data, in _page past _prog
+    uint32_t _prog;                   // end of the compressed data programmed
+    uint32_t _raw_pos;                // data compressed so far
+    uint32_t _slots;                  // index entries used, valid or not
+    flash_comp_entry_t _indexed;      // end of the last indexed block
+    flash_comp_entry_t _pending[FLASH_COMP_PENDING];
+    uint8_t _npending;
+    uint8_t _window[FLASH_LZ_WINDOW];
+    uint8_t _src[16];                 // compressed bytes being decompressed by read()
+    uint8_t _src_i;
+    uint8_t _src_n;
+    uint32_t _src_pos;
+    uint32_t _src_end;
+
+};
+
+#endif
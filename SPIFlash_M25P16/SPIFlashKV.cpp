@@ -0,0 +1,569 @@
+// * Copyright (c) 2013 Shinichiro Nakamura (https://github.com/shintamainjp)
+// > Updated April. 7, 2016, George KC,Arduino version. (https://github.com/georgekc)
+// **********************************************************************************
+// License
+// **********************************************************************************
+// This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software
+// Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will
+// be useful, but WITHOUT ANY WARRANTY; without even the
+// implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public
+// License for more details.
+//
+// You should have received a copy of the GNU General
+// Public License along with this program.
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Licence can be viewed at
+// http://www.gnu.org/licenses/gpl-3.0.txt
+//
+// Please maintain this license information along with authorship
+// and copyright notices in any redistribution of this code
+
+#include "SPIFlashKV.h"
+
+#define record_size(len) (FLASH_KV_RECORD_HDR + (((len) == FLASH_KV_LEN_DELETED) ? 0 : (len)))
+
+SPIFlashKV::SPIFlashKV(SPIFlash &flash, uint8_t first, uint8_t count) : _flash(flash)
+{
+  uint16_t i;
+  _first = first;
+  _count = (count >= 3 && first + count <= flash_SECTOR_COUNT) ? count : 0;  // 0: invalid region
+  _active = FLASH_KV_NO_SECTOR;
+  _offset = flash_SECTOR_BYTE_SIZE;
+  _victim = FLASH_KV_NO_SECTOR;
+  _victim_offset = 0;
+  _live = 0;
+  for (i = 0; i < flash_SECTOR_COUNT; i++) {
+    _seq[i] = FLASH_KV_SEQ_ERASED;
+  }
+  for (i = 0; i < SPIFLASH_KV_INDEX_SLOTS; i++) {
+    _index[i].sector = FLASH_KV_NO_SECTOR;
+  }
+}
+/**
+   @brief Mount.
+   @details
+   Rebuilds the RAM index by replaying every record of every sector, oldest sector first,
+   and resumes a compaction interrupted by a reset. Returns false if the region holds no store,
+   in which case format() must be called.
+*/
+bool SPIFlashKV::mount(void)
+{
+  uint16_t i;
+  uint8_t sector;
+  uint32_t prev;
+  uint32_t offset;
+  uint16_t key;
+  uint16_t len;
+
+  for (i = 0; i < SPIFLASH_KV_INDEX_SLOTS; i++) {
+    _index[i].sector = FLASH_KV_NO_SECTOR;
+  }
+  _live = 0;
+  _victim = FLASH_KV_NO_SECTOR;
+  _active = FLASH_KV_NO_SECTOR;
+  for (i = 0; i < _count; i++) {
+    _seq[i] = read_seq(i);
+  }
+  prev = 0;
+  for (;;) {
+    // Next sector in sequence order.
+    sector = FLASH_KV_NO_SECTOR;
+    for (i = 0; i < _count; i++) {
+      if (_seq[i] != FLASH_KV_SEQ_ERASED && _seq[i] > prev &&
+          (sector == FLASH_KV_NO_SECTOR || _seq[i] < _seq[sector])) {
+        sector = i;
+      }
+    }
+    if (sector == FLASH_KV_NO_SECTOR) {
+      break;
+    }
+    prev = _seq[sector];
+    offset = FLASH_KV_SECTOR_HDR;
+    while (read_record(sector, offset, &key, &len)) {
+      if (valid_record(sector, offset)) {
+        if (len == FLASH_KV_LEN_DELETED) {
+          index_remove(key);
+        } else {
+          index_put(key, sector, offset);
+        }
+      }
+      offset += record_size(len);
+    }
+    if (offset + FLASH_KV_RECORD_HDR <= flash_SECTOR_BYTE_SIZE && len != FLASH_KV_LEN_ERASED) {
+      offset = flash_SECTOR_BYTE_SIZE;  // torn header: do not append behind it
+    }
+    _active = sector;
+    _offset = offset;
+  }
+  if (_active == FLASH_KV_NO_SECTOR) {
+    return false;
+  }
+  if (erased_sectors() <= 1) {
+    _victim = oldest_sector();
+    _victim_offset = FLASH_KV_SECTOR_HDR;
+    if (erased_sectors() == 0) {
+      // Reset after the spare was opened: the compaction has to end before anything is written.
+      finish_compaction();
+    }
+  }
+  return true;
+}
+/**
+   @brief Format.
+   @details
+   Erases the region and opens an empty store in its first sector.
+*/
+void SPIFlashKV::format(void)
+{
+  uint8_t i;
+  uint16_t j;
+
+  if (_count == 0) {
+    return;
+  }
+  for (i = 0; i < _count; i++) {
+    _flash.flash_wait_ready();
+    _flash.flash_sector_erase(sector_addr(i));
+    _seq[i] = FLASH_KV_SEQ_ERASED;
+  }
+  _flash.flash_wait_ready();
+  for (j = 0; j < SPIFLASH_KV_INDEX_SLOTS; j++) {
+    _index[j].sector = FLASH_KV_NO_SECTOR;
+  }
+  _live = 0;
+  _victim = FLASH_KV_NO_SECTOR;
+  write_header(0, 1);
+}
+/**
+   @brief Get.
+   @details
+   Copies up to maxlen bytes of the value of key into buf.
+   Returns the length of the value, or -1 if the key does not exist.
+*/
+int16_t SPIFlashKV::get(uint16_t key, uint8_t *buf, uint16_t maxlen)
+{
+  int16_t slot;
+  uint16_t k;
+  uint16_t len;
+  uint32_t addr;
+
+  slot = index_find(key);
+  if (slot < 0) {
+    return -1;
+  }
+  read_record(_index[slot].sector, _index[slot].offset, &k, &len);
+  addr = sector_addr(_index[slot].sector) + _index[slot].offset + FLASH_KV_RECORD_HDR;
+  _flash.flash_read_data_bytes(addr, buf, (len < maxlen) ? len : maxlen);
+  return len;
+}
+/**
+   @brief Set.
+   @details
+   Stores len bytes (at most SPIFLASH_KV_MAX_VALUE) as the value of key.
+   Nothing is written if the stored value is already identical.
+   Returns false if the key is invalid, the value too large, the index full or the region out of space.
+*/
+bool SPIFlashKV::set(uint16_t key, const uint8_t *value, uint16_t len)
+{
+  uint8_t chunk[FLASH_KV_CHUNK];
+  int16_t slot;
+  uint16_t k;
+  uint16_t old;
+  uint16_t n;
+  uint16_t i;
+  uint32_t addr;
+
+  if (key == FLASH_KV_KEY_INVALID || len > SPIFLASH_KV_MAX_VALUE || _active == FLASH_KV_NO_SECTOR) {
+    return false;
+  }
+  slot = index_find(key);
+  if (slot < 0 && _live >= SPIFLASH_KV_INDEX_SLOTS - 1) {
+    return false;
+  }
+  if (slot >= 0) {
+    read_record(_index[slot].sector, _index[slot].offset, &k, &old);
+    if (old == len) {
+      addr = sector_addr(_index[slot].sector) + _index[slot].offset + FLASH_KV_RECORD_HDR;
+      for (i = 0; i < len; i += n) {
+        n = (len - i < FLASH_KV_CHUNK) ? len - i : FLASH_KV_CHUNK;
+        _flash.flash_read_data_bytes(addr + i, chunk, n);
+        if (memcmp(chunk, value + i, n) != 0) {
+          break;
+        }
+      }
+      if (i >= len) {
+        return true;
+      }
+    }
+  }
+  compact_step();
+  return write_record(key, len, value);
+}
+/**
+   @brief Remove.
+   @details
+   Deletes key. Returns false if it does not exist or the region is out of space.
+*/
+bool SPIFlashKV::remove(uint16_t key)
+{
+  if (index_find(key) < 0) {
+    return false;
+  }
+  compact_step();
+  return write_record(key, FLASH_KV_LEN_DELETED, NULL);
+}
+/**
+   @brief Compact Step.
+   @details
+   Copies the next live record of the sector being compacted, or erases that sector once it has no
+   live record left. Call it from idle time to keep compaction off the write path.
+   Returns true while a compaction is in progress.
+*/
+bool SPIFlashKV::compact_step(void)
+{
+  if (_victim == FLASH_KV_NO_SECTOR) {
+    return false;
+  }
+  if (copy_next() == 0) {
+    erase_victim();
+    return false;
+  }
+  if (erased_sectors() == 0) {
+    // The copy used up the spare: free the victim before anything else is written.
+    finish_compaction();
+  }
+  return _victim != FLASH_KV_NO_SECTOR;
+}
+/**
+   @brief Count.
+   @details
+   Number of live keys.
+*/
+uint16_t SPIFlashKV::count(void)
+{
+  return _live;
+}
+uint32_t SPIFlashKV::sector_addr(uint8_t sector)
+{
+  return (uint32_t)(_first + sector) * flash_SECTOR_BYTE_SIZE;
+}
+uint32_t SPIFlashKV::read_seq(uint8_t sector)
+{
+  uint8_t hdr[FLASH_KV_SECTOR_HDR];
+  uint32_t magic;
+
+  _flash.flash_read_data_bytes(sector_addr(sector), hdr, sizeof(hdr));
+  magic = (uint32_t)hdr[0] | ((uint32_t)hdr[1] << 8) | ((uint32_t)hdr[2] << 16) | ((uint32_t)hdr[3] << 24);
+  if (magic != FLASH_KV_MAGIC) {
+    return FLASH_KV_SEQ_ERASED;
+  }
+  return (uint32_t)hdr[4] | ((uint32_t)hdr[5] << 8) | ((uint32_t)hdr[6] << 16) | ((uint32_t)hdr[7] << 24);
+}
+/**
+   Reads the record header at offset. Returns false at the end of the records of the sector.
+*/
+bool SPIFlashKV::read_record(uint8_t sector, uint32_t offset, uint16_t *key, uint16_t *len)
+{
+  uint8_t hdr[FLASH_KV_RECORD_HDR];
+
+  if (offset + FLASH_KV_RECORD_HDR > flash_SECTOR_BYTE_SIZE) {
+    return false;
+  }
+  _flash.flash_read_data_bytes(sector_addr(sector) + offset, hdr, sizeof(hdr));
+  *key = hdr[0] | (hdr[1] << 8);
+  *len = hdr[2] | (hdr[3] << 8);
+  if (*len == FLASH_KV_LEN_ERASED || (*len > SPIFLASH_KV_MAX_VALUE && *len != FLASH_KV_LEN_DELETED)) {
+    return false;
+  }
+  return offset + record_size(*len) <= flash_SECTOR_BYTE_SIZE;
+}
+/**
+   Checks the Fletcher-16 of the record at offset, to skip records torn by a reset.
+*/
+bool SPIFlashKV::valid_record(uint8_t sector, uint32_t offset)
+{
+  uint8_t chunk[FLASH_KV_CHUNK];
+  uint16_t len;
+  uint16_t stored;
+  uint16_t sum;
+  uint16_t n;
+  uint16_t i;
+  uint32_t addr;
+
+  addr = sector_addr(sector) + offset;
+  _flash.flash_read_data_bytes(addr, chunk, FLASH_KV_RECORD_HDR);
+  len = chunk[2] | (chunk[3] << 8);
+  stored = chunk[4] | (chunk[5] << 8);
+  sum = flash_fletcher16_update(0, chunk, 4);
+  if (len == FLASH_KV_LEN_DELETED) {
+    len = 0;
+  }
+  for (i = 0; i < len; i += n) {
+    n = (len - i < FLASH_KV_CHUNK) ? len - i : FLASH_KV_CHUNK;
+    _flash.flash_read_data_bytes(addr + FLASH_KV_RECORD_HDR + i, chunk, n);
+    sum = flash_fletcher16_update(sum, chunk, n);
+  }
+  return sum == stored;
+}
+/**
+   Appends a raw copy of a live record to the active sector and points the index at the copy.
+*/
+bool SPIFlashKV::copy_record(uint8_t sector, uint32_t offset, uint16_t size)
+{
+  uint8_t chunk[FLASH_KV_CHUNK];
+  uint16_t key = FLASH_KV_KEY_INVALID;
+  uint16_t n;
+  uint16_t i;
+  uint32_t src;
+  uint32_t dst;
+
+  if (!reserve(size)) {
+    return false;
+  }
+  src = sector_addr(sector) + offset;
+  dst = sector_addr(_active) + _offset;
+  for (i = 0; i < size; i += n) {
+    n = (size - i < FLASH_KV_CHUNK) ? size - i : FLASH_KV_CHUNK;
+    _flash.flash_read_data_bytes(src + i, chunk, n);
+    if (i == 0) {
+      key = chunk[0] | (chunk[1] << 8);
+    }
+    _flash.flash_write(dst + i, chunk, n);
+  }
+  index_put(key, _active, _offset);
+  _offset += size;
+  return true;
+}
+/**
+   Appends a record. The header and the start of the value share one flash_write(),
+   so a small value costs a single PAGE PROGRAM unless it crosses a page boundary.
+*/
+bool SPIFlashKV::write_record(uint16_t key, uint16_t len, const uint8_t *value)
+{
+  uint8_t chunk[FLASH_KV_CHUNK];
+  uint16_t vlen;
+  uint16_t n;
+  uint16_t sum;
+  uint32_t addr;
+
+  vlen = (len == FLASH_KV_LEN_DELETED) ? 0 : len;
+  if (!reserve(FLASH_KV_RECORD_HDR + vlen)) {
+    return false;
+  }
+  if (erased_sectors() == 0) {
+    finish_compaction();
+    if (!reserve(FLASH_KV_RECORD_HDR + vlen)) {
+      return false;
+    }
+  }
+  chunk[0] = key;
+  chunk[1] = key >> 8;
+  chunk[2] = len;
+  chunk[3] = len >> 8;
+  sum = flash_fletcher16_update(flash_fletcher16_update(0, chunk, 4), value, vlen);
+  chunk[4] = sum;
+  chunk[5] = sum >> 8;
+  n = (vlen < FLASH_KV_CHUNK - FLASH_KV_RECORD_HDR) ? vlen : FLASH_KV_CHUNK - FLASH_KV_RECORD_HDR;
+  memcpy(chunk + FLASH_KV_RECORD_HDR, value, n);
+  addr = sector_addr(_active) + _offset;
+  _flash.flash_write(addr, chunk, FLASH_KV_RECORD_HDR + n);
+  if (vlen > n) {
+    _flash.flash_write(addr + FLASH_KV_RECORD_HDR + n, value + n, vlen - n);
+  }
+  if (len == FLASH_KV_LEN_DELETED) {
+    index_remove(key);
+  } else {
+    index_put(key, _active, _offset);
+  }
+  _offset += FLASH_KV_RECORD_HDR + vlen;
+  return true;
+}
+/**
+   Makes room for size bytes in the active sector, moving to a new sector if needed.
+*/
+bool SPIFlashKV::reserve(uint16_t size)
+{
+  if (_offset + size <= flash_SECTOR_BYTE_SIZE) {
+    return true;
+  }
+  return open_sector() && _offset + size <= flash_SECTOR_BYTE_SIZE;
+}
+/**
+   Moves the active sector to the next erased sector in ring order.
+   When this leaves only the spare erased, compaction of the oldest sector starts.
+   When it takes the spare itself, the caller must finish the running compaction
+   before writing anything else, which erases the victim and gives the spare back.
+*/
+bool SPIFlashKV::open_sector(void)
+{
+  uint8_t erased;
+  uint8_t sector;
+
+  erased = erased_sectors();
+  if (erased == 0) {
+    return false;
+  }
+  sector = _active;
+  do {
+    sector = (sector + 1) % _count;
+  } while (_seq[sector] != FLASH_KV_SEQ_ERASED);
+  write_header(sector, _seq[_active] + 1);
+  if (erased <= 2 && _victim == FLASH_KV_NO_SECTOR) {
+    _victim = oldest_sector();
+    _victim_offset = FLASH_KV_SECTOR_HDR;
+  }
+  return true;
+}
+/**
+   Writes the header of an erased sector and makes it the active sector.
+*/
+void SPIFlashKV::write_header(uint8_t sector, uint32_t seq)
+{
+  uint8_t hdr[FLASH_KV_SECTOR_HDR];
+  uint8_t i;
+
+  for (i = 0; i < 4; i++) {
+    hdr[i] = FLASH_KV_MAGIC >> (8 * i);
+    hdr[4 + i] = seq >> (8 * i);
+  }
+  _flash.flash_write(sector_addr(sector), hdr, sizeof(hdr));
+  _seq[sector] = seq;
+  _active = sector;
+  _offset = FLASH_KV_SECTOR_HDR;
+}
+/**
+   Copies the next live record of the victim. Returns 1 when a record was copied,
+   0 when the victim holds no more live records and -1 when the region is out of space.
+*/
+int8_t SPIFlashKV::copy_next(void)
+{
+  uint16_t key;
+  uint16_t len;
+  int16_t slot;
+
+  while (read_record(_victim, _victim_offset, &key, &len)) {
+    slot = index_find(key);
+    if (len != FLASH_KV_LEN_DELETED && slot >= 0 &&
+        _index[slot].sector == _victim && _index[slot].offset == _victim_offset) {
+      if (!copy_record(_victim, _victim_offset, record_size(len))) {
+        return -1;
+      }
+      _victim_offset += record_size(len);
+      return 1;
+    }
+    _victim_offset += record_size(len);
+  }
+  return 0;
+}
+void SPIFlashKV::erase_victim(void)
+{
+  _flash.flash_wait_ready();
+  _flash.flash_sector_erase(sector_addr(_victim));
+  _flash.flash_wait_ready();
+  _seq[_victim] = FLASH_KV_SEQ_ERASED;
+  _victim = FLASH_KV_NO_SECTOR;
+}
+void SPIFlashKV::finish_compaction(void)
+{
+  int8_t copied;
+  while (_victim != FLASH_KV_NO_SECTOR) {
+    copied = copy_next();
+    if (copied == 0) {
+      erase_victim();
+    } else if (copied < 0) {
+      return;
+    }
+  }
+}
+uint8_t SPIFlashKV::erased_sectors(void)
+{
+  uint8_t i;
+  uint8_t n = 0;
+  for (i = 0; i < _count; i++) {
+    if (_seq[i] == FLASH_KV_SEQ_ERASED) {
+      n++;
+    }
+  }
+  return n;
+}
+/**
+   The written sector with the lowest sequence number, other than the active one.
+*/
+uint8_t SPIFlashKV::oldest_sector(void)
+{
+  uint8_t i;
+  uint8_t sector = FLASH_KV_NO_SECTOR;
+  for (i = 0; i < _count; i++) {
+    if (i != _active && _seq[i] != FLASH_KV_SEQ_ERASED &&
+        (sector == FLASH_KV_NO_SECTOR || _seq[i] < _seq[sector])) {
+      sector = i;
+    }
+  }
+  return sector;
+}
+int16_t SPIFlashKV::index_find(uint16_t key)
+{
+  uint16_t i = (uint16_t)(key * 40503u) & (SPIFLASH_KV_INDEX_SLOTS - 1);
+  while (_index[i].sector != FLASH_KV_NO_SECTOR) {
+    if (_index[i].key == key) {
+      return i;
+    }
+    i = (i + 1) & (SPIFLASH_KV_INDEX_SLOTS - 1);
+  }
+  return -1;
+}
+bool SPIFlashKV::index_put(uint16_t key, uint8_t sector, uint16_t offset)
+{
+  uint16_t i = (uint16_t)(key * 40503u) & (SPIFLASH_KV_INDEX_SLOTS - 1);
+  while (_index[i].sector != FLASH_KV_NO_SECTOR && _index[i].key != key) {
+    i = (i + 1) & (SPIFLASH_KV_INDEX_SLOTS - 1);
+  }
+  if (_index[i].sector == FLASH_KV_NO_SECTOR) {
+    if (_live >= SPIFLASH_KV_INDEX_SLOTS - 1) {
+      return false;
+    }
+    _live++;
+  }
+  _index[i].key = key;
+  _index[i].sector = sector;
+  _index[i].offset = offset;
+  return true;
+}
+/**
+   Backward-shift deletion, so lookups never need tombstones in the index.
+*/
+void SPIFlashKV::index_remove(uint16_t key)
+{
+  int16_t found = index_find(key);
+  uint16_t i;
+  uint16_t j;
+  uint16_t h;
+
+  if (found < 0) {
+    return;
+  }
+  i = found;
+  j = i;
+  for (;;) {
+    j = (j + 1) & (SPIFLASH_KV_INDEX_SLOTS - 1);
+    if (_index[j].sector == FLASH_KV_NO_SECTOR) {
+      break;
+    }
+    h = (uint16_t)(_index[j].key * 40503u) & (SPIFLASH_KV_INDEX_SLOTS - 1);
+    // Leave the entry where it is if its home slot lies cyclically in (i, j].
+    if ((i < j) ? (h > i && h <= j) : (h > i || h <= j)) {
+      continue;
+    }
+    _index[i] = _index[j];
+    i = j;
+  }
+  _index[i].sector = FLASH_KV_NO_SECTOR;
+  _live--;
+}
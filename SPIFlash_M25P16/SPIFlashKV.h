@@ -0,0 +1,121 @@
+// * Copyright (c) 2013 Shinichiro Nakamura (https://github.com/shintamainjp)
+// > Updated April. 7, 2016, George KC, Arduino version. (https://github.com/georgekc)
+// **********************************************************************************
+// License
+// **********************************************************************************
+// This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software
+// Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will
+// be useful, but WITHOUT ANY WARRANTY; without even the
+// implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public
+// License for more details.
+//
+// You should have received a copy of the GNU General
+// Public License along with this program.
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Licence can be viewed at
+// http://www.gnu.org/licenses/gpl-3.0.txt
+//
+// Please maintain this license information along with authorship
+// and copyright notices in any redistribution of this code
+
+#ifndef _SPIFLASH_KV_H_
+#define _SPIFLASH_KV_H_
+
+
+#include "SPIFlash.h"
+
+/// Number of slots of the RAM hash index, i.e. the maximum number of live keys. Must be a power of 2.
+#ifndef SPIFLASH_KV_INDEX_SLOTS
+#define SPIFLASH_KV_INDEX_SLOTS (256)
+#endif
+
+/// Largest value accepted by set().
+#ifndef SPIFLASH_KV_MAX_VALUE
+#define SPIFLASH_KV_MAX_VALUE   (256)
+#endif
+
+#define FLASH_KV_MAGIC          (0x31564B46UL)  // "FKV1"
+#define FLASH_KV_SEQ_ERASED     (0xFFFFFFFFUL)
+#define FLASH_KV_SECTOR_HDR     (8)
+#define FLASH_KV_RECORD_HDR     (6)
+#define FLASH_KV_LEN_ERASED     (0xFFFF)
+#define FLASH_KV_LEN_DELETED    (0xFFFE)
+#define FLASH_KV_KEY_INVALID    (0xFFFF)
+#define FLASH_KV_NO_SECTOR      (0xFF)
+#define FLASH_KV_CHUNK          (64)
+
+typedef struct flash_kv_slot {
+  uint16_t key;
+  uint16_t offset;
+  uint8_t sector;  // FLASH_KV_NO_SECTOR when the slot is empty
+} flash_kv_slot_t;
+
+/**
+   @brief Key-value store with out-of-place updates.
+   @details
+   Uses sectors [first, first + count) of the device, count >= 3. Each sector starts with a magic word
+   and a sequence number. Records are appended to the active sector: key (2 bytes), value length (2 bytes),
+   a Fletcher-16 check over key, length and value, then the value. Updating a key appends a new record,
+   which costs one PAGE PROGRAM for small values instead of a sector erase; the previous record becomes stale.
+   Removing a key appends a record with length FLASH_KV_LEN_DELETED.
+
+   A RAM hash index (open addressing, linear probing) maps each live key to its newest record.
+   mount() rebuilds it by scanning the sectors in sequence order.
+
+   At least one sector is always kept erased as a spare. When only the spare is left, compaction starts:
+   the live records of the oldest sector are copied to the active sector one per compact_step()
+   (also run once by every set()/remove()), after which the oldest sector is erased.
+   The live data must fit in count - 2 sectors.
+   The store needs count >= 3 sectors inside the device; with any other region mount() and set()
+   fail, and format() does nothing.
+*/
+class SPIFlashKV {
+  public:
+    SPIFlashKV(SPIFlash &flash, uint8_t first, uint8_t count);
+    bool mount(void);
+    void format(void);
+    int16_t get(uint16_t key, uint8_t *buf, uint16_t maxlen);
+    bool set(uint16_t key, const uint8_t *value, uint16_t len);
+    bool remove(uint16_t key);
+    bool compact_step(void);
+    uint16_t count(void);
+  protected:
+    uint32_t sector_addr(uint8_t sector);
+    uint32_t read_seq(uint8_t sector);
+    bool read_record(uint8_t sector, uint32_t offset, uint16_t *key, uint16_t *len);
+    bool valid_record(uint8_t sector, uint32_t offset);
+    bool copy_record(uint8_t sector, uint32_t offset, uint16_t size);
+    bool write_record(uint16_t key, uint16_t len, const uint8_t *value);
+    bool reserve(uint16_t size);
+    bool open_sector(void);
+    void write_header(uint8_t sector, uint32_t seq);
+    int8_t copy_next(void);
+    void erase_victim(void);
+    void finish_compaction(void);
+    uint8_t erased_sectors(void);
+    uint8_t oldest_sector(void);
+    int16_t index_find(uint16_t key);
+    bool index_put(uint16_t key, uint8_t sector, uint16_t offset);
+    void index_remove(uint16_t key);
+
+    SPIFlash &_flash;
+    uint8_t _first;
+    uint8_t _count;
+    uint8_t _active;
+    uint32_t _offset;    // next free byte in the active sector
+    uint32_t _seq[flash_SECTOR_COUNT];
+    uint8_t _victim;     // sector being compacted, FLASH_KV_NO_SECTOR when idle
+    uint32_t _victim_offset;
+    uint16_t _live;
+    flash_kv_slot_t _index[SPIFLASH_KV_INDEX_SLOTS];
+
+};
+
+#endif
@@ -0,0 +1,210 @@
+// * Copyright (c) 2013 Shinichiro Nakamura (https://github.com/shintamainjp)
+// > Updated April. 7, 2016, George KC,Arduino version. (https://github.com/georgekc)
+// **********************************************************************************
+// License
+// **********************************************************************************
+// This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software
+// Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will
+// be useful, but WITHOUT ANY WARRANTY; without even the
+// implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public
+// License for more details.
+//
+// You should have received a copy of the GNU General
+// Public License along with this program.
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Licence can be viewed at
+// http://www.gnu.org/licenses/gpl-3.0.txt
+//
+// Please maintain this license information along with authorship
+// and copyright notices in any redistribution of this code
+
+#include "SPIFlashLZ.h"
+
+#define FLASH_LZ_HASH_SIZE    (1U << SPIFLASH_LZ_HASH_BITS)
+#define FLASH_LZ_NO_POS       (0xFFFF)
+
+/// Bit packer of flash_lz_compress(), flushed to the sink every sizeof(buf) bytes.
+typedef struct flash_lz_out {
+  flash_sink_t sink;
+  void *ctx;
+  uint8_t buf[16];
+  uint8_t n;
+  uint8_t acc;
+  uint8_t bits;
+  uint32_t total;
+} flash_lz_out_t;
+
+static void flash_lz_put(flash_lz_out_t *o, uint16_t value, uint8_t count)
+{
+  while (count-- > 0) {
+    o->acc = (o->acc << 1) | ((value >> count) & 1);
+    if (++o->bits == 8) {
+      o->buf[o->n++] = o->acc;
+      o->total++;
+      o->acc = 0;
+      o->bits = 0;
+      if (o->n == sizeof(o->buf)) {
+        o->sink(o->ctx, o->buf, o->n);
+        o->n = 0;
+      }
+    }
+  }
+}
+/// Bit reader of flash_lz_decompress().
+typedef struct flash_lz_in {
+  flash_lz_source_t src;
+  void *ctx;
+  uint16_t acc;
+  uint8_t bits;
+} flash_lz_in_t;
+
+/**
+   Returns the next count (at most 8) bits, or -1 when the source runs dry.
+*/
+static int16_t flash_lz_get(flash_lz_in_t *in, uint8_t count)
+{
+  int16_t c;
+  if (in->bits < count) {
+    c = in->src(in->ctx);
+    if (c < 0) {
+      return -1;
+    }
+    in->acc = (in->acc << 8) | (uint8_t)c;
+    in->bits += 8;
+  }
+  in->bits -= count;
+  return (in->acc >> in->bits) & ((1U << count) - 1);
+}
+static uint16_t flash_lz_hash(const uint8_t *p)
+{
+  return (uint16_t)((((uint16_t)p[0] << 8) | p[1]) * 40503U) >> (16 - SPIFLASH_LZ_HASH_BITS);
+}
+static uint8_t flash_lz_match(const uint8_t *in, uint32_t pos, uint32_t cand, uint32_t max)
+{
+  uint8_t n = 0;
+  while (n < max && in[cand + n] == in[pos + n]) {
+    n++;
+  }
+  return n;
+}
+uint32_t flash_lz_compress(const uint8_t *in, uint32_t len, flash_sink_t sink, void *ctx)
+{
+  uint16_t head[FLASH_LZ_HASH_SIZE];
+  flash_lz_out_t o;
+  uint32_t pos = 0;
+  uint32_t cand;
+  uint32_t max;
+  uint32_t dist = 0;
+  uint8_t best;
+  uint8_t n;
+  uint16_t i;
+
+  for (i = 0; i < FLASH_LZ_HASH_SIZE; i++) {
+    head[i] = FLASH_LZ_NO_POS;
+  }
+  o.sink = sink;
+  o.ctx = ctx;
+  o.n = 0;
+  o.acc = 0;
+  o.bits = 0;
+  o.total = 0;
+  while (pos < len) {
+    best = 0;
+    max = len - pos;
+    if (max > FLASH_LZ_MAX_MATCH) {
+      max = FLASH_LZ_MAX_MATCH;
+    }
+    if (max >= FLASH_LZ_MIN_MATCH) {
+      i = flash_lz_hash(&in[pos]);
+      cand = head[i];
+      head[i] = pos;
+      if (cand != FLASH_LZ_NO_POS && pos - cand <= FLASH_LZ_WINDOW) {
+        best = flash_lz_match(in, pos, cand, max);
+        dist = pos - cand;
+      }
+      if (pos > 0 && best < max) {
+        n = flash_lz_match(in, pos, pos - 1, max);  // run of the previous byte
+        if (n > best) {
+          best = n;
+          dist = 1;
+        }
+      }
+    }
+    if (best >= FLASH_LZ_MIN_MATCH) {
+      flash_lz_put(&o, 0, 1);
+      flash_lz_put(&o, dist - 1, SPIFLASH_LZ_WINDOW_BITS);
+      flash_lz_put(&o, best - FLASH_LZ_MIN_MATCH, SPIFLASH_LZ_LENGTH_BITS);
+      for (n = 1; n < best; n++) {
+        if (pos + n + 1 < len) {
+          head[flash_lz_hash(&in[pos + n])] = pos + n;
+        }
+      }
+      pos += best;
+    } else {
+      flash_lz_put(&o, 0x100 | in[pos], 9);
+      pos++;
+    }
+  }
+  if (o.bits > 0) {
+    flash_lz_put(&o, 0, 8 - o.bits);
+  }
+  if (o.n > 0) {
+    sink(ctx, o.buf, o.n);
+  }
+  return o.total;
+}
+uint32_t flash_lz_decompress(flash_lz_source_t src, void *ctx, uint8_t *window, uint32_t skip, uint8_t *out, uint32_t len)
+{
+  flash_lz_in_t in;
+  uint32_t end = skip + len;
+  uint32_t pos = 0;
+  int16_t flag;
+  int16_t value;
+  int16_t dist;
+  int16_t n;
+
+  in.src = src;
+  in.ctx = ctx;
+  in.acc = 0;
+  in.bits = 0;
+  while (pos < end) {
+    flag = flash_lz_get(&in, 1);
+    if (flag < 0) {
+      break;
+    }
+    if (flag) {
+      value = flash_lz_get(&in, 8);
+      if (value < 0) {
+        break;
+      }
+      window[pos % FLASH_LZ_WINDOW] = value;
+      if (pos >= skip) {
+        out[pos - skip] = value;
+      }
+      pos++;
+      continue;
+    }
+    dist = flash_lz_get(&in, SPIFLASH_LZ_WINDOW_BITS);
+    n = flash_lz_get(&in, SPIFLASH_LZ_LENGTH_BITS);
+    if (dist < 0 || n < 0) {
+      break;
+    }
+    dist += 1;
+    n += FLASH_LZ_MIN_MATCH;
+    for (; n > 0 && pos < end; n--) {
+      window[pos % FLASH_LZ_WINDOW] = window[(pos - dist) % FLASH_LZ_WINDOW];
+      if (pos >= skip) {
+        out[pos - skip] = window[pos % FLASH_LZ_WINDOW];
+      }
+      pos++;
+    }
+  }
+  return (pos > skip) ? pos - skip : 0;
+}
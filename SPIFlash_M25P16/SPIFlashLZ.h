@@ -0,0 +1,91 @@
+// * Copyright (c) 2013 Shinichiro Nakamura (https://github.com/shintamainjp)
+// > Updated April. 7, 2016, George KC, Arduino version. (https://github.com/georgekc)
+// **********************************************************************************
+// License
+// **********************************************************************************
+// This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software
+// Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will
+// be useful, but WITHOUT ANY WARRANTY; without even the
+// implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public
+// License for more details.
+//
+// You should have received a copy of the GNU General
+// Public License along with this program.
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Licence can be viewed at
+// http://www.gnu.org/licenses/gpl-3.0.txt
+//
+// Please maintain this license information along with authorship
+// and copyright notices in any redistribution of this code
+
+#ifndef _SPIFLASH_LZ_H_
+#define _SPIFLASH_LZ_H_
+
+
+#include "SPIFlashTransport.h"
+
+/// Distance field of a back-reference: the window is the 2^SPIFLASH_LZ_WINDOW_BITS bytes before the current one.
+#ifndef SPIFLASH_LZ_WINDOW_BITS
+#define SPIFLASH_LZ_WINDOW_BITS  (8)
+#endif
+
+/// Length field of a back-reference: matches of FLASH_LZ_MIN_MATCH to FLASH_LZ_MAX_MATCH bytes.
+#ifndef SPIFLASH_LZ_LENGTH_BITS
+#define SPIFLASH_LZ_LENGTH_BITS  (4)
+#endif
+
+/// Entries (2 bytes each, on the stack of flash_lz_compress()) of the hash table of match candidates.
+#ifndef SPIFLASH_LZ_HASH_BITS
+#if defined(__AVR__)
+#define SPIFLASH_LZ_HASH_BITS    (6)
+#else
+#define SPIFLASH_LZ_HASH_BITS    (10)
+#endif
+#endif
+
+// flash_lz_get() reads at most 8 bits per field and matches are counted in a uint8_t.
+#if SPIFLASH_LZ_WINDOW_BITS < 1 || SPIFLASH_LZ_WINDOW_BITS > 8
+#error "SPIFLASH_LZ_WINDOW_BITS must be 1 to 8"
+#endif
+#if SPIFLASH_LZ_LENGTH_BITS < 1 || SPIFLASH_LZ_LENGTH_BITS > 7
+#error "SPIFLASH_LZ_LENGTH_BITS must be 1 to 7"
+#endif
+#if SPIFLASH_LZ_HASH_BITS < 1 || SPIFLASH_LZ_HASH_BITS > 15
+#error "SPIFLASH_LZ_HASH_BITS must be 1 to 15"
+#endif
+
+#define FLASH_LZ_WINDOW         (1U << SPIFLASH_LZ_WINDOW_BITS)
+#define FLASH_LZ_MIN_MATCH       (2)
+#define FLASH_LZ_MAX_MATCH       (FLASH_LZ_MIN_MATCH + (1U << SPIFLASH_LZ_LENGTH_BITS) - 1)
+
+/// Largest compressed size of len bytes: every byte a 9-bit literal.
+#define FLASH_LZ_BOUND(len)      (((uint32_t)(len) * 9 + 7) / 8)
+
+/// Returns the next compressed byte for flash_lz_decompress(), or -1 when there is none.
+typedef int16_t (*flash_lz_source_t)(void *ctx);
+
+/**
+   LZSS in the style of heatshrink: a bit stream, MSB first, of tokens
+   - 1 and an 8-bit literal,
+   - 0, the distance minus 1 (SPIFLASH_LZ_WINDOW_BITS) and the length minus FLASH_LZ_MIN_MATCH (SPIFLASH_LZ_LENGTH_BITS)
+     of a copy of earlier output,
+   padded with 0 bits to a whole byte at the end. The decoder must be told the decompressed length.
+
+   flash_lz_compress() compresses the len (less than 65535) bytes at in, which also serve as its window, and hands the result to sink
+   in small pieces; it returns the compressed size. Candidates come from a hash of the next two bytes (one per
+   hash entry) and from the previous byte, so each input byte costs a constant time.
+   flash_lz_decompress() pulls compressed bytes from src, keeps the last FLASH_LZ_WINDOW bytes of output in window,
+   drops the first skip bytes of output and stores the next len bytes in out. It returns the number of bytes stored,
+   less than len only if src runs dry.
+*/
+uint32_t flash_lz_compress(const uint8_t *in, uint32_t len, flash_sink_t sink, void *ctx);
+uint32_t flash_lz_decompress(flash_lz_source_t src, void *ctx, uint8_t *window, uint32_t skip, uint8_t *out, uint32_t len);
+
+#endif
@@ -0,0 +1,295 @@
+// * Copyright (c) 2013 Shinichiro Nakamura (https://github.com/shintamainjp)
+// > Updated April. 7, 2016, George KC,Arduino version. (https://github.com/georgekc)
+// **********************************************************************************
+// License
+// **********************************************************************************
+// This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software
+// Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will
+// be useful, but WITHOUT ANY WARRANTY; without even the
+// implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public
+// License for more details.
+//
+// You should have received a copy of the GNU General
+// Public License along with this program.
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Licence can be viewed at
+// http://www.gnu.org/licenses/gpl-3.0.txt
+//
+// Please maintain this license information along with authorship
+// and copyright notices in any redistribution of this code
+
+#include "SPIFlashLog.h"
+
+SPIFlashLog::SPIFlashLog(SPIFlash &flash, uint8_t first, uint8_t count) : _flash(flash)
+{
+  _first = first;
+  _count = (count >= 2 && first + count <= flash_SECTOR_COUNT) ? count : 0;  // 0: invalid region
+  _head = 0;
+  _seq = FLASH_LOG_SEQ_ERASED;
+  _offset = flash_SECTOR_BYTE_SIZE;
+}
+/**
+   @brief Mount.
+   @details
+   Finds the write head and the next free offset. Returns false if the region does not hold a log,
+   in which case format() must be called before append().
+*/
+bool SPIFlashLog::mount(void)
+{
+  uint8_t lo;
+  uint8_t hi;
+  uint8_t mid;
+  uint8_t ahead;
+  uint32_t seq0;
+  uint32_t seq;
+  uint8_t hdr[FLASH_LOG_RECORD_HDR];
+  uint16_t len;
+
+  if (_count == 0) {
+    return false;
+  }
+  seq0 = read_seq(0);
+  if (seq0 == FLASH_LOG_SEQ_ERASED) {
+    // Sector 0 can only be the erased sector ahead of a head sitting on the last sector.
+    if (read_seq(_count - 1) == FLASH_LOG_SEQ_ERASED) {
+      return false;
+    }
+    lo = _count - 1;
+  } else {
+    // Last sector whose sequence number is not lower than sector 0's: the maximum of the rotated run.
+    lo = 0;
+    hi = _count;
+    while (hi - lo > 1) {
+      mid = lo + (hi - lo) / 2;
+      seq = read_seq(mid);
+      if (seq != FLASH_LOG_SEQ_ERASED && seq >= seq0) {
+        lo = mid;
+      } else {
+        hi = mid;
+      }
+    }
+  }
+  _head = lo;
+  _seq = read_seq(_head);
+
+  // Walk the records of the head sector to find the free space.
+  _offset = FLASH_LOG_SECTOR_HDR;
+  while (_offset + FLASH_LOG_RECORD_HDR <= flash_SECTOR_BYTE_SIZE) {
+    _flash.flash_read_data_bytes(sector_addr(_head) + _offset, hdr, sizeof(hdr));
+    len = hdr[0] | (hdr[1] << 8);
+    if (len == FLASH_LOG_LEN_ERASED) {
+      break;
+    }
+    if (len > FLASH_LOG_MAX_RECORD) {
+      _offset = flash_SECTOR_BYTE_SIZE;  // torn header: leave the rest of the sector alone
+      break;
+    }
+    _offset += FLASH_LOG_RECORD_HDR + len;
+  }
+
+  // A power loss between moving the head and erasing ahead leaves old data in front of the head.
+  ahead = (_head + 1) % _count;
+  if (read_seq(ahead) != FLASH_LOG_SEQ_ERASED) {
+    erase_sector(ahead);
+  }
+  return true;
+}
+/**
+   @brief Format.
+   @details
+   Erases the whole region and opens an empty log in its first sector.
+*/
+void SPIFlashLog::format(void)
+{
+  uint8_t i;
+  if (_count == 0) {
+    return;
+  }
+  for (i = 0; i < _count; i++) {
+    erase_sector(i);
+  }
+  open_sector(0, 1);
+}
+/**
+   @brief Append.
+   @details
+   Writes one record of len bytes (at most FLASH_LOG_MAX_RECORD).
+   When the head sector is full the head moves to the erased sector ahead of it,
+   and the next (oldest) sector is erased to keep one erased sector in front of the head.
+   The header and the start of the data share one flash_write(), so a record of up to
+   FLASH_LOG_CHUNK - FLASH_LOG_RECORD_HDR bytes costs a single PAGE PROGRAM unless it crosses a page boundary.
+   Returns false if the record is too large or the log is not mounted.
+*/
+bool SPIFlashLog::append(const uint8_t *data, uint16_t len)
+{
+  uint8_t chunk[FLASH_LOG_CHUNK];
+  uint16_t sum;
+  uint16_t n;
+  uint32_t addr;
+
+  if (_seq == FLASH_LOG_SEQ_ERASED || len > FLASH_LOG_MAX_RECORD) {
+    return false;
+  }
+  if (_offset + FLASH_LOG_RECORD_HDR + len > flash_SECTOR_BYTE_SIZE) {
+    open_sector((_head + 1) % _count, _seq + 1);
+    erase_sector((_head + 1) % _count);
+  }
+  sum = flash_fletcher16_update(0, data, len);
+  chunk[0] = len;
+  chunk[1] = len >> 8;
+  chunk[2] = sum;
+  chunk[3] = sum >> 8;
+  n = (len < FLASH_LOG_CHUNK - FLASH_LOG_RECORD_HDR) ? len : FLASH_LOG_CHUNK - FLASH_LOG_RECORD_HDR;
+  memcpy(chunk + FLASH_LOG_RECORD_HDR, data, n);
+  addr = sector_addr(_head) + _offset;
+  _flash.flash_write(addr, chunk, FLASH_LOG_RECORD_HDR + n);
+  if (len > n) {
+    _flash.flash_write(addr + FLASH_LOG_RECORD_HDR + n, data + n, len - n);
+  }
+  _offset += FLASH_LOG_RECORD_HDR + len;
+  return true;
+}
+/**
+   @brief Rewind.
+   @details
+   Places cursor on the oldest record of the log.
+*/
+void SPIFlashLog::rewind(flash_log_cursor_t *cursor)
+{
+  if (_count == 0) {
+    cursor->sector = 0;
+    cursor->seq = FLASH_LOG_SEQ_ERASED;
+    cursor->offset = FLASH_LOG_SECTOR_HDR;
+    return;
+  }
+  cursor->sector = tail_sector();
+  cursor->seq = read_seq(cursor->sector);
+  cursor->offset = FLASH_LOG_SECTOR_HDR;
+}
+/**
+   @brief Next.
+   @details
+   Copies up to maxlen bytes of the record at cursor into buf and advances the cursor.
+   Returns the full length of the record, or -1 when there are no more records.
+   If the writer has erased the sector under the cursor, reading continues from the new tail.
+*/
+int32_t SPIFlashLog::next(flash_log_cursor_t *cursor, uint8_t *buf, uint16_t maxlen)
+{
+  uint8_t hdr[FLASH_LOG_RECORD_HDR];
+  uint16_t len;
+  uint16_t sum;
+  uint32_t addr;
+
+  if (_count == 0) {
+    return -1;
+  }
+  for (;;) {
+    if (read_seq(cursor->sector) != cursor->seq) {
+      rewind(cursor);
+      if (cursor->seq == FLASH_LOG_SEQ_ERASED) {
+        return -1;
+      }
+    }
+    len = FLASH_LOG_LEN_ERASED;
+    if (cursor->offset + FLASH_LOG_RECORD_HDR <= flash_SECTOR_BYTE_SIZE) {
+      _flash.flash_read_data_bytes(sector_addr(cursor->sector) + cursor->offset, hdr, sizeof(hdr));
+      len = hdr[0] | (hdr[1] << 8);
+    }
+    if (len == FLASH_LOG_LEN_ERASED || len > FLASH_LOG_MAX_RECORD ||
+        cursor->offset + FLASH_LOG_RECORD_HDR + len > flash_SECTOR_BYTE_SIZE) {
+      // End of this sector's records.
+      if (cursor->sector == _head) {
+        return -1;
+      }
+      cursor->sector = (cursor->sector + 1) % _count;
+      cursor->seq = read_seq(cursor->sector);
+      cursor->offset = FLASH_LOG_SECTOR_HDR;
+      continue;
+    }
+    addr = sector_addr(cursor->sector) + cursor->offset + FLASH_LOG_RECORD_HDR;
+    cursor->offset += FLASH_LOG_RECORD_HDR + len;
+    if (len > maxlen) {
+      // Too large for the caller's buffer: the check cannot be verified, report the length only.
+      _flash.flash_read_data_bytes(addr, buf, maxlen);
+      return len;
+    }
+    _flash.flash_read_data_bytes(addr, buf, len);
+    sum = hdr[2] | (hdr[3] << 8);
+    if (flash_fletcher16_update(0, buf, len) == sum) {
+      return len;
+    }
+  }
+}
+/**
+   @brief Used Sectors.
+   @details
+   Number of sectors currently holding records, including the head sector.
+*/
+uint8_t SPIFlashLog::used_sectors(void)
+{
+  if (_count == 0) {
+    return 0;
+  }
+  return (_head + _count - tail_sector()) % _count + 1;
+}
+uint32_t SPIFlashLog::sector_addr(uint8_t sector)
+{
+  return (uint32_t)(_first + sector) * flash_SECTOR_BYTE_SIZE;
+}
+/**
+   Returns the sequence number of a sector, or FLASH_LOG_SEQ_ERASED if it has no valid header.
+*/
+uint32_t SPIFlashLog::read_seq(uint8_t sector)
+{
+  uint8_t hdr[FLASH_LOG_SECTOR_HDR];
+  uint32_t magic;
+
+  _flash.flash_read_data_bytes(sector_addr(sector), hdr, sizeof(hdr));
+  magic = (uint32_t)hdr[0] | ((uint32_t)hdr[1] << 8) | ((uint32_t)hdr[2] << 16) | ((uint32_t)hdr[3] << 24);
+  if (magic != FLASH_LOG_MAGIC) {
+    return FLASH_LOG_SEQ_ERASED;
+  }
+  return (uint32_t)hdr[4] | ((uint32_t)hdr[5] << 8) | ((uint32_t)hdr[6] << 16) | ((uint32_t)hdr[7] << 24);
+}
+void SPIFlashLog::erase_sector(uint8_t sector)
+{
+  _flash.flash_wait_ready();
+  _flash.flash_sector_erase(sector_addr(sector));
+  _flash.flash_wait_ready();
+}
+/**
+   Writes the header of an erased sector and makes it the write head.
+*/
+void SPIFlashLog::open_sector(uint8_t sector, uint32_t seq)
+{
+  uint8_t hdr[FLASH_LOG_SECTOR_HDR];
+  uint8_t i;
+
+  for (i = 0; i < 4; i++) {
+    hdr[i] = FLASH_LOG_MAGIC >> (8 * i);
+    hdr[4 + i] = seq >> (8 * i);
+  }
+  _flash.flash_write(sector_addr(sector), hdr, sizeof(hdr));
+  _head = sector;
+  _seq = seq;
+  _offset = FLASH_LOG_SECTOR_HDR;
+}
+/**
+   The oldest sector: the one after the erased sector ahead of the head once the ring has wrapped,
+   otherwise sector 0.
+*/
+uint8_t SPIFlashLog::tail_sector(void)
+{
+  uint8_t sector = (_head + 2) % _count;
+  if (read_seq(sector) != FLASH_LOG_SEQ_ERASED) {
+    return sector;
+  }
+  return (read_seq(0) != FLASH_LOG_SEQ_ERASED) ? 0 : _head;
+}
@@ -0,0 +1,95 @@
+// * Copyright (c) 2013 Shinichiro Nakamura (https://github.com/shintamainjp)
+// > Updated April. 7, 2016, George KC, Arduino version. (https://github.com/georgekc)
+// **********************************************************************************
+// License
+// **********************************************************************************
+// This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software
+// Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will
+// be useful, but WITHOUT ANY WARRANTY; without even the
+// implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public
+// License for more details.
+//
+// You should have received a copy of the GNU General
+// Public License along with this program.
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Licence can be viewed at
+// http://www.gnu.org/licenses/gpl-3.0.txt
+//
+// Please maintain this license information along with authorship
+// and copyright notices in any redistribution of this code
+
+#ifndef _SPIFLASH_LOG_H_
+#define _SPIFLASH_LOG_H_
+
+
+#include "SPIFlash.h"
+
+#define FLASH_LOG_MAGIC        (0x474F4C46UL)  // "FLOG"
+#define FLASH_LOG_SEQ_ERASED   (0xFFFFFFFFUL)
+#define FLASH_LOG_SECTOR_HDR   (8)
+#define FLASH_LOG_RECORD_HDR   (4)
+#define FLASH_LOG_LEN_ERASED   (0xFFFF)
+/// Size of the buffer in which append() joins a record header and the start of its data.
+#define FLASH_LOG_CHUNK        (64)
+/// Largest record that fits in one sector after the sector and record headers.
+#define FLASH_LOG_MAX_RECORD   (flash_SECTOR_BYTE_SIZE - FLASH_LOG_SECTOR_HDR - FLASH_LOG_RECORD_HDR - 1)
+
+/// Position of a reader in the log. Filled by SPIFlashLog::rewind().
+typedef struct flash_log_cursor {
+  uint8_t sector;
+  uint32_t seq;
+  uint32_t offset;
+} flash_log_cursor_t;
+
+/**
+   @brief Append-only circular log store.
+   @details
+   Uses sectors [first, first + count) of the device as a ring.
+   Every sector starts with an 8-byte header: a magic word and a sequence number that grows
+   by one each time the write head moves to a new sector. Records follow back to back:
+   a 2-byte length, a 2-byte Fletcher-16 check of the data, then the data. Records never span sectors.
+
+   The sector after the write head is always kept erased, so moving the head only costs the
+   8-byte header program; the sector erased ahead is the oldest one, which also makes every
+   sector of the ring go through the same number of erase cycles.
+
+   Since sequence numbers increase around the ring, mount() locates the head with a binary search
+   over sector headers (log2(count) reads) and then walks the records of the head sector only.
+   Records whose check does not match (torn by a power loss) are skipped by readers.
+
+   The ring needs count >= 2 sectors inside the device; with any other region mount() and append()
+   fail, and format() does nothing.
+*/
+class SPIFlashLog {
+  public:
+    SPIFlashLog(SPIFlash &flash, uint8_t first = 0, uint8_t count = flash_SECTOR_COUNT);
+    bool mount(void);
+    void format(void);
+    bool append(const uint8_t *data, uint16_t len);
+    void rewind(flash_log_cursor_t *cursor);
+    int32_t next(flash_log_cursor_t *cursor, uint8_t *buf, uint16_t maxlen);
+    uint8_t used_sectors(void);
+  protected:
+    uint32_t sector_addr(uint8_t sector);
+    uint32_t read_seq(uint8_t sector);
+    void erase_sector(uint8_t sector);
+    void open_sector(uint8_t sector, uint32_t seq);
+    uint8_t tail_sector(void);
+
+    SPIFlash &_flash;
+    uint8_t _first;
+    uint8_t _count;
+    uint8_t _head;
+    uint32_t _seq;      // sequence number of the head sector
+    uint32_t _offset;   // next free byte in the head sector
+
+};
+
+#endif
@@ -0,0 +1,206 @@
+// * Copyright (c) 2013 Shinichiro Nakamura (https://github.com/shintamainjp)
+// > Updated April. 7, 2016, George KC,Arduino version. (https://github.com/georgekc)
+// **********************************************************************************
+// License
+// **********************************************************************************
+// This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software
+// Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will
+// be useful, but WITHOUT ANY WARRANTY; without even the
+// implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public
+// License for more details.
+//
+// You should have received a copy of the GNU General
+// Public License along with this program.
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Licence can be viewed at
+// http://www.gnu.org/licenses/gpl-3.0.txt
+//
+// Please maintain this license information along with authorship
+// and copyright notices in any redistribution of this code
+
+#include "SPIFlashReader.h"
+
+SPIFlashReader::SPIFlashReader(SPIFlash &flash, uint32_t addr, uint32_t len) : _flash(flash)
+{
+  _addr = addr;
+  _len = len;
+  _base[0] = 0;
+  _base[1] = 0;
+  _count[0] = 0;
+  _count[1] = 0;
+  _cur = 0;
+  _pos = 0;
+  _fill_pos = 0;
+}
+/**
+   @brief Available.
+   @details
+   Returns the number of bytes left before the end of the region, capped at 32767 to fit in an int.
+*/
+int SPIFlashReader::available(void)
+{
+  uint32_t left = _len - _pos;
+  return (left > 0x7FFF) ? 0x7FFF : (int)left;
+}
+/**
+   @brief Read.
+   @details
+   Returns the next byte, or -1 at the end of the region.
+*/
+int SPIFlashReader::read(void)
+{
+  int c = peek();
+  if (c >= 0) {
+    _pos++;
+  }
+  return c;
+}
+/**
+   @brief Peek.
+   @details
+   Returns the next byte without consuming it, or -1 at the end of the region.
+*/
+int SPIFlashReader::peek(void)
+{
+  if (_pos >= _len || !ready()) {
+    return -1;
+  }
+  return _buf[_cur][_pos - _base[_cur]];
+}
+/**
+   @brief Read Bytes.
+   @details
+   Copies up to len bytes to buf and returns how many were copied (fewer only at the end of the region).
+   Buffered bytes are copied first; when nothing is buffered, whole blocks are read straight into buf.
+*/
+size_t SPIFlashReader::read(uint8_t *buf, size_t len)
+{
+  size_t done = 0;
+  size_t n;
+
+  if (len > _len - _pos) {
+    len = _len - _pos;
+  }
+  while (done < len) {
+    if (_pos - _base[_cur] >= _count[_cur] && _count[_cur ^ 1] == 0 && len - done >= SPIFLASH_READER_BLOCK) {
+      n = len - done;
+      _flash.flash_stream_read(_addr + _pos, buf + done, n);
+      _count[_cur] = 0;
+      _pos += n;
+      _fill_pos = _pos;
+      done += n;
+      continue;
+    }
+    if (!ready()) {
+      break;
+    }
+    n = _count[_cur] - (_pos - _base[_cur]);
+    if (n > len - done) {
+      n = len - done;
+    }
+    memcpy(buf + done, &_buf[_cur][_pos - _base[_cur]], n);
+    _pos += n;
+    done += n;
+  }
+  return done;
+}
+/**
+   The region is read-only.
+*/
+size_t SPIFlashReader::write(uint8_t c)
+{
+  (void)c;
+  return 0;
+}
+void SPIFlashReader::flush(void)
+{
+}
+/**
+   @brief Seek.
+   @details
+   Moves to position pos of the region. Returns false, without moving, if pos is past its end.
+*/
+bool SPIFlashReader::seek(uint32_t pos)
+{
+  if (pos > _len) {
+    return false;
+  }
+  if (!(pos - _base[_cur] < _count[_cur]) && !(pos - _base[_cur ^ 1] < _count[_cur ^ 1])) {
+    _count[0] = 0;
+    _count[1] = 0;
+    _fill_pos = pos;
+  }
+  _pos = pos;
+  return true;
+}
+uint32_t SPIFlashReader::position(void)
+{
+  return _pos;
+}
+uint32_t SPIFlashReader::size(void)
+{
+  return _len;
+}
+/**
+   @brief Poll.
+   @details
+   Fetches the next block into the spare buffer if it is empty and the region has more data.
+*/
+void SPIFlashReader::poll(void)
+{
+  if (_count[_cur ^ 1] == 0) {
+    fill(_cur ^ 1);
+  }
+}
+/**
+   @brief End.
+   @details
+   Ends the open READ and releases the SPI bus. Buffered data stays available; reading past it starts a new READ.
+*/
+void SPIFlashReader::end(void)
+{
+  _flash.flash_stream_end();
+}
+/**
+   Makes the current buffer hold the byte at _pos: moves on to the spare buffer once the current one
+   is used up, and fetches a block if neither holds it. Returns false at the end of the region.
+*/
+bool SPIFlashReader::ready(void)
+{
+  if (_pos - _base[_cur] < _count[_cur]) {
+    return true;
+  }
+  _count[_cur] = 0;
+  _cur ^= 1;
+  if (_pos - _base[_cur] < _count[_cur]) {
+    return true;
+  }
+  _count[_cur] = 0;
+  _fill_pos = _pos;
+  return fill(_cur);
+}
+/**
+   Fetches the block at _fill_pos into buffer b. Returns false when the region has no more data.
+*/
+bool SPIFlashReader::fill(uint8_t b)
+{
+  uint32_t n = _len - _fill_pos;
+  if (n == 0) {
+    return false;
+  }
+  if (n > SPIFLASH_READER_BLOCK) {
+    n = SPIFLASH_READER_BLOCK;
+  }
+  _flash.flash_stream_read(_addr + _fill_pos, _buf[b], n);
+  _base[b] = _fill_pos;
+  _count[b] = n;
+  _fill_pos += n;
+  return true;
+}
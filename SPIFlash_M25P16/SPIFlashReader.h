@@ -0,0 +1,89 @@
+// * Copyright (c) 2013 Shinichiro Nakamura (https://github.com/shintamainjp)
+// > Updated April. 7, 2016, George KC, Arduino version. (https://github.com/georgekc)
+// **********************************************************************************
+// License
+// **********************************************************************************
+// This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software
+// Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will
+// be useful, but WITHOUT ANY WARRANTY; without even the
+// implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public
+// License for more details.
+//
+// You should have received a copy of the GNU General
+// Public License along with this program.
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Licence can be viewed at
+// http://www.gnu.org/licenses/gpl-3.0.txt
+//
+// Please maintain this license information along with authorship
+// and copyright notices in any redistribution of this code
+
+#ifndef _SPIFLASH_READER_H_
+#define _SPIFLASH_READER_H_
+
+
+#include "SPIFlash.h"
+
+/// Bytes in each of the two read-ahead buffers of SPIFlashReader.
+#ifndef SPIFLASH_READER_BLOCK
+#define SPIFLASH_READER_BLOCK  (64)
+#endif
+
+/**
+   @brief Sequential reader of a region of the device, usable as an Arduino Stream.
+   @details
+   Reads the len bytes at addr through two buffers of SPIFLASH_READER_BLOCK bytes.
+   Blocks are fetched with SPIFlash::flash_stream_read(), so consecutive blocks continue one READ
+   with S# held LOW and cost only their data bytes on the bus.
+   While the consumer works through one buffer, poll() fills the other, so calling it from idle time
+   (e.g. between audio samples) keeps a full block ready and read() never waits for the bus.
+   Without poll() the next block is fetched on demand when the current one runs out.
+   seek() inside the buffered data costs nothing; elsewhere it drops the buffers and the next block starts a new READ.
+   The open READ reserves the SPI bus: end() releases it, and so does any other command sent to the device.
+   Positions are offsets from addr. write() is not supported.
+*/
+#ifdef ARDUINO
+class SPIFlashReader : public Stream {
+#else
+class SPIFlashReader {
+#endif
+  public:
+    SPIFlashReader(SPIFlash &flash, uint32_t addr, uint32_t len);
+    int available(void);
+    int read(void);
+    int peek(void);
+    size_t read(uint8_t *buf, size_t len);
+    size_t write(uint8_t c);
+    void flush(void);
+    bool seek(uint32_t pos);
+    uint32_t position(void);
+    uint32_t size(void);
+    void poll(void);
+    void end(void);
+#ifdef ARDUINO
+    using Print::write;
+#endif
+  protected:
+    bool ready(void);
+    bool fill(uint8_t b);
+
+    SPIFlash &_flash;
+    uint32_t _addr;
+    uint32_t _len;
+    uint8_t _buf[2][SPIFLASH_READER_BLOCK];
+    uint32_t _base[2];          // position of the first byte of each buffer
+    uint16_t _count[2];         // bytes held by each buffer, 0 when empty
+    uint8_t _cur;               // buffer read() takes bytes from
+    uint32_t _pos;              // position of the next byte returned by read()
+    uint32_t _fill_pos;         // position of the next byte fetched from the device
+
+};
+
+#endif
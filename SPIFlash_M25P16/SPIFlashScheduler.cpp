@@ -0,0 +1,425 @@
+// * Copyright (c) 2013 Shinichiro Nakamura (https://github.com/shintamainjp)
+// > Updated April. 7, 2016, George KC,Arduino version. (https://github.com/georgekc)
+// **********************************************************************************
+// License
+// **********************************************************************************
+// This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software
+// Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will
+// be useful, but WITHOUT ANY WARRANTY; without even the
+// implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public
+// License for more details.
+//
+// You should have received a copy of the GNU General
+// Public License along with this program.
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Licence can be viewed at
+// http://www.gnu.org/licenses/gpl-3.0.txt
+//
+// Please maintain this license information along with authorship
+// and copyright notices in any redistribution of this code
+
+#include "SPIFlashScheduler.h"
+
+SPIFlashScheduler::SPIFlashScheduler(SPIFlash &flash) : _flash(flash)
+{
+  memset(_ops, 0, sizeof(_ops));
+  _active = NULL;
+  _count = 0;
+  _seq = 0;
+  _next = FLASH_HANDLE_NONE;
+  reset_stats();
+}
+/**
+   @brief Submit Read.
+   @details
+   Queues a read of len bytes at addr into buf, in priority class cls (FLASH_SCHED_URGENT,
+   FLASH_SCHED_NORMAL or FLASH_SCHED_BACKGROUND), to be completed within deadline_us of now.
+   A read covered by queued writes completes before read() returns, callback included.
+   Returns FLASH_HANDLE_NONE if the queue is full.
+*/
+flash_handle_t SPIFlashScheduler::read(uint32_t addr, uint8_t *buf, uint32_t len, uint8_t cls,
+                                       uint32_t deadline_us, flash_completion_t cb, void *ctx)
+{
+  flash_sched_op_t *op;
+  flash_handle_t handle;
+
+  op = submit(FLASH_SCHED_READ, addr, len, cls, deadline_us, cb, ctx);
+  if (op == NULL) {
+    return FLASH_HANDLE_NONE;
+  }
+  op->dst = buf;
+  handle = op->handle;
+  if (buffered(op)) {
+    memset(buf, 0xFF, len);
+    overlay(op);
+    _stats[op->cls].buffered++;
+    complete(op);
+  } else {
+    poll();
+  }
+  return handle;
+}
+/**
+   @brief Submit Program.
+   @details
+   Queues a program of len bytes at addr, split on page boundaries like flash_write(),
+   one PAGE PROGRAM per cycle. Returns FLASH_HANDLE_NONE if the queue is full.
+*/
+flash_handle_t SPIFlashScheduler::program(uint32_t addr, const uint8_t *buf, uint32_t len, uint8_t cls,
+                                          uint32_t deadline_us, flash_completion_t cb, void *ctx)
+{
+  flash_sched_op_t *op;
+  flash_handle_t handle;
+
+  op = submit(FLASH_SCHED_PROGRAM, addr, len, cls, deadline_us, cb, ctx);
+  if (op == NULL) {
+    return FLASH_HANDLE_NONE;
+  }
+  op->src = buf;
+  handle = op->handle;
+  poll();
+  return handle;
+}
+/**
+   @brief Submit Erase.
+   @details
+   Queues the erase of every sector touched by the len bytes at addr, one SECTOR ERASE per cycle.
+   Erasing the whole array this way instead of with BULK ERASE lets reads run between sectors.
+   Returns FLASH_HANDLE_NONE if the queue is full.
+*/
+flash_handle_t SPIFlashScheduler::erase(uint32_t addr, uint32_t len, uint8_t cls,
+                                        uint32_t deadline_us, flash_completion_t cb, void *ctx)
+{
+  flash_sched_op_t *op;
+  flash_handle_t handle;
+  uint32_t end = addr + len;
+
+  if (len > 0) {
+    addr -= addr % flash_SECTOR_BYTE_SIZE;
+    end += (flash_SECTOR_BYTE_SIZE - end % flash_SECTOR_BYTE_SIZE) % flash_SECTOR_BYTE_SIZE;
+    len = end - addr;
+  }
+  op = submit(FLASH_SCHED_ERASE, addr, len, cls, deadline_us, cb, ctx);
+  if (op == NULL) {
+    return FLASH_HANDLE_NONE;
+  }
+  handle = op->handle;
+  poll();
+  return handle;
+}
+/**
+   @brief Poll.
+   @details
+   Reads the status register once if a cycle is in progress and returns while WIP is set.
+   Otherwise runs the queued reads in priority order until the most urgent request is a write,
+   issues its next cycle, and returns. Completion callbacks run from here.
+   Returns true while requests are still queued.
+*/
+bool SPIFlashScheduler::poll(void)
+{
+  flash_sched_op_t *op;
+
+  if (_active != NULL) {
+    if (_flash.flash_busy()) {
+      return true;
+    }
+    op = _active;
+    _active = NULL;
+    op->done += op->chunk;
+    op->chunk = 0;
+    if (op->done >= op->len) {
+      complete(op);
+    }
+  }
+  while (_active == NULL && (op = next()) != NULL) {
+    if (op->type == FLASH_SCHED_READ) {
+      _flash.flash_read_data_bytes(op->addr, op->dst, op->len);
+      overlay(op);
+      complete(op);
+    } else if (op->done >= op->len) {
+      complete(op);
+    } else if (!issue(op)) {
+      complete(op, false);  // nothing is running, so the loop moves on to the next request
+    }
+  }
+  return _count > 0;
+}
+/**
+   @brief Pending.
+   @details
+   Returns true while the request identified by handle is queued or running.
+*/
+bool SPIFlashScheduler::pending(flash_handle_t handle)
+{
+  uint8_t i;
+  for (i = 0; i < SPIFLASH_SCHED_QUEUE_LEN; i++) {
+    if (_ops[i].type != 0 && _ops[i].handle == handle) {
+      return true;
+    }
+  }
+  return false;
+}
+/**
+   @brief Idle.
+   @details
+   Returns true when no request is queued or running.
+*/
+bool SPIFlashScheduler::idle(void)
+{
+  return _count == 0;
+}
+/**
+   @brief Get Stats.
+   @details
+   Copies the counters of priority class cls, accumulated since construction or reset_stats().
+   A request misses its deadline when it completes more than deadline_us after its submission.
+*/
+void SPIFlashScheduler::get_stats(uint8_t cls, flash_sched_stats_t *stats)
+{
+  if (cls < FLASH_SCHED_CLASSES) {
+    *stats = _stats[cls];
+  } else {
+    memset(stats, 0, sizeof(*stats));
+  }
+}
+/**
+   @brief Reset Stats.
+*/
+void SPIFlashScheduler::reset_stats(void)
+{
+  memset(_stats, 0, sizeof(_stats));
+}
+flash_sched_op_t *SPIFlashScheduler::submit(uint8_t type, uint32_t addr, uint32_t len, uint8_t cls,
+                                            uint32_t deadline_us, flash_completion_t cb, void *ctx)
+{
+  flash_sched_op_t *op = NULL;
+  uint8_t i;
+
+  for (i = 0; i < SPIFLASH_SCHED_QUEUE_LEN && op == NULL; i++) {
+    if (_ops[i].type == 0) {
+      op = &_ops[i];
+    }
+  }
+  if (op == NULL) {
+    return NULL;
+  }
+  if (++_next == FLASH_HANDLE_NONE) {
+    _next++;
+  }
+  memset(op, 0, sizeof(*op));
+  op->handle = _next;
+  op->type = type;
+  op->cls = cls < FLASH_SCHED_CLASSES ? cls : FLASH_SCHED_BACKGROUND;
+  op->seq = ++_seq;
+  op->addr = addr;
+  op->len = len;
+  op->submitted = _flash.flash_now_us();
+  op->deadline_us = deadline_us;
+  op->cb = cb;
+  op->ctx = ctx;
+  _count++;
+  return op;
+}
+/**
+   Returns the request to run next, or NULL when none can run: the first by class, deadline
+   and submission order among the reads and the writes not held back by blocked().
+*/
+flash_sched_op_t *SPIFlashScheduler::next(void)
+{
+  flash_sched_op_t *best = NULL;
+  uint32_t now = _flash.flash_now_us();
+  uint8_t i;
+
+  for (i = 0; i < SPIFLASH_SCHED_QUEUE_LEN; i++) {
+    flash_sched_op_t *op = &_ops[i];
+    if (op->type == 0 || blocked(op)) {
+      continue;
+    }
+    if (best == NULL || before(op, best, now)) {
+      best = op;
+    }
+  }
+  return best;
+}
+/**
+   A write may not pass an earlier request it overlaps: an earlier read must not see it,
+   and two writes to the same bytes do not commute once an erase is involved.
+   Reads are never blocked, overlay() makes up for the writes they pass.
+*/
+bool SPIFlashScheduler::blocked(const flash_sched_op_t *op)
+{
+  uint32_t start = start_of(op);
+  uint8_t i;
+
+  if (op->type == FLASH_SCHED_READ) {
+    return false;
+  }
+  for (i = 0; i < SPIFLASH_SCHED_QUEUE_LEN; i++) {
+    const flash_sched_op_t *p = &_ops[i];
+    if (p->type == 0 || p->seq >= op->seq) {
+      continue;
+    }
+    if (start_of(p) < op->addr + op->len && start < p->addr + p->len) {
+      return true;
+    }
+  }
+  return false;
+}
+/**
+   Returns true when a should run before b: lower class first, then the one closest to
+   (or furthest past) its deadline, requests without a deadline last, then the oldest.
+*/
+bool SPIFlashScheduler::before(const flash_sched_op_t *a, const flash_sched_op_t *b, uint32_t now)
+{
+  int32_t slack_a, slack_b;
+
+  if (a->cls != b->cls) {
+    return a->cls < b->cls;
+  }
+  if ((a->deadline_us == FLASH_SCHED_NO_DEADLINE) != (b->deadline_us == FLASH_SCHED_NO_DEADLINE)) {
+    return b->deadline_us == FLASH_SCHED_NO_DEADLINE;
+  }
+  if (a->deadline_us != FLASH_SCHED_NO_DEADLINE) {
+    slack_a = (int32_t)(a->submitted + a->deadline_us - now);
+    slack_b = (int32_t)(b->submitted + b->deadline_us - now);
+    if (slack_a != slack_b) {
+      return slack_a < slack_b;
+    }
+  }
+  return a->seq < b->seq;
+}
+/**
+   Returns true when every byte of the read op is still covered by an earlier queued write,
+   so the result does not depend on the array.
+*/
+bool SPIFlashScheduler::buffered(const flash_sched_op_t *op)
+{
+  uint32_t pos = op->addr;
+  uint32_t end = op->addr + op->len;
+  bool advanced = true;
+  uint8_t i;
+
+  while (pos < end && advanced) {
+    advanced = false;
+    for (i = 0; i < SPIFLASH_SCHED_QUEUE_LEN; i++) {
+      const flash_sched_op_t *p = &_ops[i];
+      if (p->type == 0 || p->type == FLASH_SCHED_READ || p->seq >= op->seq) {
+        continue;
+      }
+      if (start_of(p) <= pos && pos < p->addr + p->len) {
+        pos = p->addr + p->len;
+        advanced = true;
+      }
+    }
+  }
+  return pos >= end;
+}
+/**
+   Applies to the data of the read op, in submission order, the part still to be done of every
+   earlier queued write: an erase sets its bytes to FFh and a program clears the bits that are 0
+   in its buffer, as the device itself will.
+*/
+void SPIFlashScheduler::overlay(flash_sched_op_t *op)
+{
+  uint32_t last = 0;
+  uint32_t from, to, k;
+  uint8_t i;
+  const flash_sched_op_t *p;
+
+  for (;;) {
+    p = NULL;
+    for (i = 0; i < SPIFLASH_SCHED_QUEUE_LEN; i++) {
+      const flash_sched_op_t *q = &_ops[i];
+      if (q->type == 0 || q->type == FLASH_SCHED_READ || q->seq <= last || q->seq >= op->seq) {
+        continue;
+      }
+      if (p == NULL || q->seq < p->seq) {
+        p = q;
+      }
+    }
+    if (p == NULL) {
+      break;
+    }
+    last = p->seq;
+    from = start_of(p) > op->addr ? start_of(p) : op->addr;
+    to = p->addr + p->len < op->addr + op->len ? p->addr + p->len : op->addr + op->len;
+    for (k = from; k < to; k++) {
+      if (p->type == FLASH_SCHED_ERASE) {
+        op->dst[k - op->addr] = 0xFF;
+      } else {
+        op->dst[k - op->addr] &= p->src[k - p->addr];
+      }
+    }
+  }
+}
+/**
+   Issues the next cycle of the write op: WRITE ENABLE followed by one page of the program or
+   one SECTOR ERASE. The device must not be busy. Returns false if the device refused the command.
+*/
+bool SPIFlashScheduler::issue(flash_sched_op_t *op)
+{
+  uint32_t addr = op->addr + op->done;
+  bool ok;
+
+  if (op->type == FLASH_SCHED_ERASE) {
+    op->chunk = flash_SECTOR_BYTE_SIZE;
+    ok = _flash.flash_sector_erase(addr);
+  } else {
+    op->chunk = flash_PAGE_BYTE_SIZE - (addr % flash_PAGE_BYTE_SIZE);
+    if (op->chunk > op->len - op->done) {
+      op->chunk = op->len - op->done;
+    }
+    ok = _flash.flash_page_program(addr, op->src + op->done, op->chunk);
+  }
+  if (!ok) {
+    op->chunk = 0;
+    return false;
+  }
+  _active = op;
+  return true;
+}
+/**
+   Accounts for op in the stats of its class, as completed or as failed (ok false),
+   frees its slot and runs its callback.
+*/
+void SPIFlashScheduler::complete(flash_sched_op_t *op, bool ok)
+{
+  flash_sched_stats_t *s = &_stats[op->cls];
+  uint32_t latency = _flash.flash_now_us() - op->submitted;
+  flash_handle_t handle = op->handle;
+  flash_completion_t cb = op->cb;
+  void *ctx = op->ctx;
+
+  if (!ok) {
+    s->failed++;
+  } else {
+    s->completed++;
+    s->total_us += latency;
+    if (latency > s->max_us) {
+      s->max_us = latency;
+    }
+    if (op->deadline_us != FLASH_SCHED_NO_DEADLINE && latency > op->deadline_us) {
+      s->missed++;
+    }
+  }
+  op->type = 0;
+  _count--;
+  if (cb != NULL) {
+    cb(handle, ctx);
+  }
+}
+/**
+   First byte of op the device has not dealt with yet: the whole range of a read,
+   what is left of a program or an erase.
+*/
+uint32_t SPIFlashScheduler::start_of(const flash_sched_op_t *op)
+{
+  return op->type == FLASH_SCHED_READ ? op->addr : op->addr + op->done;
+}
@@ -0,0 +1,137 @@
+// * Copyright (c) 2013 Shinichiro Nakamura (https://github.com/shintamainjp)
+// > Updated April. 7, 2016, George KC, Arduino version. (https://github.com/georgekc)
+// **********************************************************************************
+// License
+// **********************************************************************************
+// This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software
+// Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will
+// be useful, but WITHOUT ANY WARRANTY; without even the
+// implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public
+// License for more details.
+//
+// You should have received a copy of the GNU General
+// Public License along with this program.
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Licence can be viewed at
+// http://www.gnu.org/licenses/gpl-3.0.txt
+//
+// Please maintain this license information along with authorship
+// and copyright notices in any redistribution of this code
+
+#ifndef _SPIFLASH_SCHEDULER_H_
+#define _SPIFLASH_SCHEDULER_H_
+
+
+#include "SPIFlash.h"
+#include "SPIFlashAsync.h"
+
+/// Number of reads, programs and erases that can be queued at once.
+#ifndef SPIFLASH_SCHED_QUEUE_LEN
+#define SPIFLASH_SCHED_QUEUE_LEN (8)
+#endif
+
+/// Priority classes, most urgent first. Indexes of get_stats().
+#define FLASH_SCHED_URGENT      (0)
+#define FLASH_SCHED_NORMAL      (1)
+#define FLASH_SCHED_BACKGROUND  (2)
+#define FLASH_SCHED_CLASSES     (3)
+
+/// Passed as deadline_us when a request has no deadline.
+#define FLASH_SCHED_NO_DEADLINE (0)
+
+#define FLASH_SCHED_READ        (1)
+#define FLASH_SCHED_PROGRAM     (2)
+#define FLASH_SCHED_ERASE       (3)
+
+typedef struct flash_sched_op {
+  flash_handle_t handle;
+  uint8_t type;          // 0 for a free slot
+  uint8_t cls;
+  uint32_t seq;          // submission order
+  uint32_t addr;
+  uint32_t len;
+  uint32_t done;         // bytes programmed or erased by completed cycles
+  uint32_t chunk;        // bytes of the cycle in progress
+  uint8_t *dst;
+  const uint8_t *src;
+  uint32_t submitted;
+  uint32_t deadline_us;
+  flash_completion_t cb;
+  void *ctx;
+} flash_sched_op_t;
+
+/// Per-class counters. Average latency is total_us / completed; latency runs from submission to completion.
+typedef struct flash_sched_stats {
+  uint32_t completed;
+  uint32_t failed;       // programs and erases the device refused, not counted as completed
+  uint32_t missed;       // completed after their deadline
+  uint32_t buffered;     // reads answered from queued writes, without a device access
+  uint32_t total_us;
+  uint32_t max_us;
+} flash_sched_stats_t;
+
+/**
+   @brief Prioritized command queue.
+   @details
+   Accepts reads, programs and erases, each with a priority class and an optional deadline,
+   and runs them without ever sending a command while WIP is set; poll() must be called regularly.
+   Programs are issued one page per cycle and erases one sector per cycle, so whenever a cycle ends
+   the most urgent request runs next: a read waits for at most one PAGE PROGRAM or SECTOR ERASE,
+   never for a whole batch. Within a class the earliest deadline goes first, then the oldest request.
+
+   A read sees every program and erase queued before it. A read fully covered by such writes still
+   in the queue is answered from their buffers at once, even during a cycle; otherwise it is read
+   from the array once WIP clears and the queued writes are applied on top. Writes keep their order
+   with respect to any earlier request they overlap. As with flash_write(), programs must target
+   erased memory, and their buffers must stay valid until they complete.
+   No other command may be sent to the device while requests are queued.
+   A program or erase the device refuses (WEL not set or a protected area) is dropped with what is left of it:
+   its callback still runs, but it counts as failed, not completed, in the stats of its class.
+*/
+class SPIFlashScheduler {
+  public:
+    SPIFlashScheduler(SPIFlash &flash);
+    flash_handle_t read(uint32_t addr, uint8_t *buf, uint32_t len, uint8_t cls = FLASH_SCHED_NORMAL,
+                        uint32_t deadline_us = FLASH_SCHED_NO_DEADLINE,
+                        flash_completion_t cb = NULL, void *ctx = NULL);
+    flash_handle_t program(uint32_t addr, const uint8_t *buf, uint32_t len, uint8_t cls = FLASH_SCHED_NORMAL,
+                           uint32_t deadline_us = FLASH_SCHED_NO_DEADLINE,
+                           flash_completion_t cb = NULL, void *ctx = NULL);
+    flash_handle_t erase(uint32_t addr, uint32_t len, uint8_t cls = FLASH_SCHED_BACKGROUND,
+                         uint32_t deadline_us = FLASH_SCHED_NO_DEADLINE,
+                         flash_completion_t cb = NULL, void *ctx = NULL);
+    bool poll(void);
+    bool pending(flash_handle_t handle);
+    bool idle(void);
+    void get_stats(uint8_t cls, flash_sched_stats_t *stats);
+    void reset_stats(void);
+  protected:
+    flash_sched_op_t *submit(uint8_t type, uint32_t addr, uint32_t len, uint8_t cls, uint32_t deadline_us,
+                             flash_completion_t cb, void *ctx);
+    flash_sched_op_t *next(void);
+    bool blocked(const flash_sched_op_t *op);
+    bool before(const flash_sched_op_t *a, const flash_sched_op_t *b, uint32_t now);
+    bool buffered(const flash_sched_op_t *op);
+    void overlay(flash_sched_op_t *op);
+    bool issue(flash_sched_op_t *op);
+    void complete(flash_sched_op_t *op, bool ok = true);
+    static uint32_t start_of(const flash_sched_op_t *op);
+
+    SPIFlash &_flash;
+    flash_sched_op_t _ops[SPIFLASH_SCHED_QUEUE_LEN];
+    flash_sched_op_t *_active;    // the write whose cycle is in progress, NULL when none
+    uint8_t _count;
+    uint32_t _seq;
+    flash_handle_t _next;
+    flash_sched_stats_t _stats[FLASH_SCHED_CLASSES];
+
+};
+
+#endif
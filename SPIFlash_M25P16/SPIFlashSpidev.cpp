@@ -0,0 +1,219 @@
+// * Copyright (c) 2013 Shinichiro Nakamura (https://github.com/shintamainjp)
+// > Updated April. 7, 2016, George KC,Arduino version. (https://github.com/georgekc)
+// **********************************************************************************
+// License
+// **********************************************************************************
+// This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software
+// Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will
+// be useful, but WITHOUT ANY WARRANTY; without even the
+// implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public
+// License for more details.
+//
+// You should have received a copy of the GNU General
+// Public License along with this program.
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Licence can be viewed at
+// http://www.gnu.org/licenses/gpl-3.0.txt
+//
+// Please maintain this license information along with authorship
+// and copyright notices in any redistribution of this code
+
+
+#include "SPIFlashSpidev.h"
+
+#if defined(__linux__) && !defined(ARDUINO)
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+SPIFlashSpidev::SPIFlashSpidev(const char *path, uint32_t speed_hz)
+{
+  _path = path;
+  _fd = -1;
+  _speed = speed_hz;
+  _n = 0;
+  _bytes = 0;
+  _messages = 0;
+  _errors = 0;
+  memset(_xfers, 0, sizeof(_xfers));
+}
+SPIFlashSpidev::~SPIFlashSpidev()
+{
+  if (_fd >= 0) {
+    close(_fd);
+  }
+}
+/**
+   Opens the device node and sets mode 0, 8 bits per word and the maximum clock.
+   Returns false if any of these fails.
+*/
+bool SPIFlashSpidev::begin(void)
+{
+  uint8_t mode = SPI_MODE_0;
+  uint8_t bits = 8;
+
+  if (_fd < 0) {
+    _fd = open(_path, O_RDWR);
+  }
+  if (_fd < 0) {
+    return false;
+  }
+  return ioctl(_fd, SPI_IOC_WR_MODE, &mode) >= 0 &&
+         ioctl(_fd, SPI_IOC_WR_BITS_PER_WORD, &bits) >= 0 &&
+         ioctl(_fd, SPI_IOC_WR_MAX_SPEED_HZ, &_speed) >= 0;
+}
+void SPIFlashSpidev::run(const flash_xfer_t *xfers, uint8_t count)
+{
+  const flash_xfer_t *x;
+  uint32_t off;
+  uint32_t n;
+  uint32_t addr;
+  uint8_t *hdr;
+
+  for (x = xfers; x < xfers + count; x++) {
+    off = 0;
+    do {
+      n = x->len - off;
+      if (n > SPIFLASH_SPIDEV_BUFSIZ - FLASH_XFER_HDR_MAX) {
+        n = SPIFLASH_SPIDEV_BUFSIZ - FLASH_XFER_HDR_MAX;
+      }
+      if (_n + 2 > SPIFLASH_SPIDEV_MAX_XFERS || _bytes + x->hdr_len + n > SPIFLASH_SPIDEV_BUFSIZ) {
+        flush();
+      }
+      hdr = _hdr[_n];
+      memcpy(hdr, x->hdr, x->hdr_len);
+      if (off > 0) {
+        // Continuation of a long READ at the next address.
+        addr = (((uint32_t)hdr[1] << 16) | ((uint32_t)hdr[2] << 8) | hdr[3]) + off;
+        hdr[1] = addr >> 16;
+        hdr[2] = addr >> 8;
+        hdr[3] = addr >> 0;
+      }
+      add(hdr, NULL, x->hdr_len);
+      if (n > 0) {
+        add((x->tx != NULL) ? x->tx + off : NULL, (x->rx != NULL) ? x->rx + off : NULL, n);
+      }
+      _xfers[_n - 1].cs_change = 1;  // end of the command: pulse S#
+      off += n;
+    } while (off < x->len);
+  }
+  flush();
+}
+/**
+   Reads into _stream one buffer at a time, each as its own READ at the next address, and passes it to sink.
+*/
+void SPIFlashSpidev::read_stream(const flash_xfer_t *x, flash_sink_t sink, void *ctx)
+{
+  flash_xfer_t part = *x;
+  uint32_t addr = ((uint32_t)x->hdr[1] << 16) | ((uint32_t)x->hdr[2] << 8) | x->hdr[3];
+  uint32_t off;
+
+  part.rx = _stream;
+  for (off = 0; off < x->len; off += part.len) {
+    part.len = (x->len - off < sizeof(_stream)) ? x->len - off : sizeof(_stream);
+    part.hdr[1] = (addr + off) >> 16;
+    part.hdr[2] = (addr + off) >> 8;
+    part.hdr[3] = (addr + off) >> 0;
+    run(&part, 1);
+    sink(ctx, _stream, part.len);
+  }
+}
+/**
+   Sleeps for expect_us, then reads the status register until WIP is 0. Most cycles are over by then,
+   so the first message holds a single read; the following ones hold SPIFLASH_SPIDEV_POLLS reads,
+   each a command of its own, spaced so that a message spans expect_us / 16. The end of the cycle is
+   seen at most that late, and a cycle running up to its maximum (about five times the typical time)
+   costs some 80 system calls instead of one per poll. Returns the number of status bytes read.
+*/
+uint32_t SPIFlashSpidev::wait_ready(uint32_t expect_us)
+{
+  static const uint8_t cmd[2] = { SPI_READ_STATUS_REGISTER, 0 };
+  uint8_t sreg[SPIFLASH_SPIDEV_POLLS][2];
+  uint32_t gap = expect_us / (16 * SPIFLASH_SPIDEV_POLLS);
+  uint32_t polls = 0;
+  uint32_t errors;
+  unsigned count = 1;
+  unsigned i;
+
+  if (gap > 0xFFFF) {
+    gap = 0xFFFF;
+  }
+  if (expect_us > 0) {
+    delay_us(expect_us);
+  }
+  for (;;) {
+    for (i = 0; i < count; i++) {
+      add(cmd, sreg[i], sizeof(cmd));
+      _xfers[_n - 1].cs_change = 1;
+      _xfers[_n - 1].delay_usecs = gap;
+    }
+    errors = _errors;
+    flush();
+    if (_errors != errors) {
+      return polls;  // the status was not read; waiting on would never end
+    }
+    for (i = 0; i < count; i++) {
+      polls++;
+      if (!FLASH_SREG_WRITE_IN_PROGRESS(sreg[i][1])) {
+        return polls;
+      }
+    }
+    count = SPIFLASH_SPIDEV_POLLS;
+  }
+}
+uint32_t SPIFlashSpidev::clock_hz(void)
+{
+  return _speed;
+}
+/**
+   Number of SPI_IOC_MESSAGE ioctls issued so far.
+*/
+uint32_t SPIFlashSpidev::messages(void)
+{
+  return _messages;
+}
+/**
+   Number of SPI_IOC_MESSAGE ioctls that failed.
+*/
+uint32_t SPIFlashSpidev::errors(void)
+{
+  return _errors;
+}
+void SPIFlashSpidev::add(const uint8_t *tx, uint8_t *rx, uint32_t len)
+{
+  struct spi_ioc_transfer *t = &_xfers[_n++];
+  memset(t, 0, sizeof(*t));
+  t->tx_buf = (unsigned long)tx;
+  t->rx_buf = (unsigned long)rx;
+  t->len = len;
+  t->speed_hz = _speed;
+  t->bits_per_word = 8;
+  _bytes += len;
+}
+void SPIFlashSpidev::flush(void)
+{
+  if (_n == 0) {
+    return;
+  }
+  _xfers[_n - 1].cs_change = 0;  // S# goes HIGH at the end of the message
+  if (message(_xfers, _n) < 0) {
+    _errors++;
+  }
+  _messages++;
+  _n = 0;
+  _bytes = 0;
+}
+int SPIFlashSpidev::message(struct spi_ioc_transfer *xfers, unsigned count)
+{
+  return ioctl(_fd, SPI_IOC_MESSAGE(count), xfers);
+}
+
+#endif
@@ -0,0 +1,100 @@
+// * Copyright (c) 2013 Shinichiro Nakamura (https://github.com/shintamainjp)
+// > Updated April. 7, 2016, George KC, Arduino version. (https://github.com/georgekc)
+// **********************************************************************************
+// License
+// **********************************************************************************
+// This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software
+// Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will
+// be useful, but WITHOUT ANY WARRANTY; without even the
+// implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public
+// License for more details.
+//
+// You should have received a copy of the GNU General
+// Public License along with this program.
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Licence can be viewed at
+// http://www.gnu.org/licenses/gpl-3.0.txt
+//
+// Please maintain this license information along with authorship
+// and copyright notices in any redistribution of this code
+
+
+#ifndef _SPIFLASH_SPIDEV_H_
+#define _SPIFLASH_SPIDEV_H_
+
+
+#include "SPIFlash.h"
+
+#if defined(__linux__) && !defined(ARDUINO)
+
+#include <linux/spi/spidev.h>
+
+/// Bytes per SPI_IOC_MESSAGE, the default bufsiz of the spidev driver.
+#ifndef SPIFLASH_SPIDEV_BUFSIZ
+#define SPIFLASH_SPIDEV_BUFSIZ     (4096)
+#endif
+
+/// Transfers per SPI_IOC_MESSAGE (each command takes two: header and data).
+#ifndef SPIFLASH_SPIDEV_MAX_XFERS
+#define SPIFLASH_SPIDEV_MAX_XFERS  (16)
+#endif
+
+/// READ STATUS REGISTER commands sent per SPI_IOC_MESSAGE by wait_ready().
+#ifndef SPIFLASH_SPIDEV_POLLS
+#define SPIFLASH_SPIDEV_POLLS      (8)
+#endif
+#if SPIFLASH_SPIDEV_POLLS > SPIFLASH_SPIDEV_MAX_XFERS
+#error "SPIFLASH_SPIDEV_POLLS must not exceed SPIFLASH_SPIDEV_MAX_XFERS"
+#endif
+
+/**
+   @brief Linux spidev backend.
+   @details
+   Sends every batch handed over by SPIFlash as a single SPI_IOC_MESSAGE ioctl: one spi_ioc_transfer
+   for the header and one for the data of each command, with cs_change set at the end of each command
+   so S# is pulsed between them. WRITE ENABLE + PAGE PROGRAM, for instance, cost one system call.
+   A batch that does not fit in SPIFLASH_SPIDEV_BUFSIZ bytes is split over several messages;
+   a READ longer than that is issued as several READs at consecutive addresses.
+   read_stream() reads into an internal buffer of that size, one message per buffer.
+   wait_ready() sleeps through the expected rest of the cycle, then sends SPIFLASH_SPIDEV_POLLS status reads
+   per message, spaced by delay_usecs, instead of one system call per poll.
+*/
+class SPIFlashSpidev : public SPIFlashTransport {
+  public:
+    SPIFlashSpidev(const char *path, uint32_t speed_hz = flash_CLOCK_MAX_HZ);
+    virtual ~SPIFlashSpidev();
+    bool begin(void);
+    void run(const flash_xfer_t *xfers, uint8_t count);
+    void read_stream(const flash_xfer_t *x, flash_sink_t sink, void *ctx);
+    uint32_t wait_ready(uint32_t expect_us = 0);
+    uint32_t clock_hz(void);
+    uint32_t messages(void);
+    uint32_t errors(void);
+  protected:
+    void add(const uint8_t *tx, uint8_t *rx, uint32_t len);
+    void flush(void);
+    virtual int message(struct spi_ioc_transfer *xfers, unsigned count);
+
+    const char *_path;
+    int _fd;
+    uint32_t _speed;
+    struct spi_ioc_transfer _xfers[SPIFLASH_SPIDEV_MAX_XFERS];
+    uint8_t _hdr[SPIFLASH_SPIDEV_MAX_XFERS][FLASH_XFER_HDR_MAX];
+    uint8_t _stream[SPIFLASH_SPIDEV_BUFSIZ - FLASH_XFER_HDR_MAX];
+    unsigned _n;
+    uint32_t _bytes;
+    uint32_t _messages;
+    uint32_t _errors;
+
+};
+
+#endif
+
+#endif
@@ -0,0 +1,379 @@
+// * Copyright (c) 2013 Shinichiro Nakamura (https://github.com/shintamainjp)
+// > Updated April. 7, 2016, George KC,Arduino version. (https://github.com/georgekc)
+// **********************************************************************************
+// License
+// **********************************************************************************
+// This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software
+// Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will
+// be useful, but WITHOUT ANY WARRANTY; without even the
+// implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public
+// License for more details.
+//
+// You should have received a copy of the GNU General
+// Public License along with this program.
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Licence can be viewed at
+// http://www.gnu.org/licenses/gpl-3.0.txt
+//
+// Please maintain this license information along with authorship
+// and copyright notices in any redistribution of this code
+
+
+#include "SPIFlash.h"
+#if !defined(ARDUINO) && defined(__unix__)
+#include <time.h>
+#endif
+
+/**
+   Prepares the link. Returns false if the device cannot be reached.
+*/
+bool SPIFlashTransport::begin(void)
+{
+  return true;
+}
+/**
+   Runs the READ x (address in hdr[1..3], no rx buffer) for x->len bytes and passes the data to sink.
+   This default issues one READ per SPIFLASH_STREAM_CHUNK bytes at consecutive addresses;
+   backends that can hold S# LOW across chunks use a single READ.
+*/
+void SPIFlashTransport::read_stream(const flash_xfer_t *x, flash_sink_t sink, void *ctx)
+{
+  uint8_t chunk[SPIFLASH_STREAM_CHUNK];
+  flash_xfer_t part = *x;
+  uint32_t addr = ((uint32_t)x->hdr[1] << 16) | ((uint32_t)x->hdr[2] << 8) | x->hdr[3];
+  uint32_t off;
+
+  part.rx = chunk;
+  for (off = 0; off < x->len; off += part.len) {
+    part.len = (x->len - off < sizeof(chunk)) ? x->len - off : sizeof(chunk);
+    part.hdr[1] = (addr + off) >> 16;
+    part.hdr[2] = (addr + off) >> 8;
+    part.hdr[3] = (addr + off) >> 0;
+    run(&part, 1);
+    sink(ctx, chunk, part.len);
+  }
+}
+/**
+   Starts the READ x (no data phase) and keeps the device selected for read_next().
+   Returns false when the backend cannot do that; the caller then issues a READ per block instead.
+*/
+bool SPIFlashTransport::read_open(const flash_xfer_t *x)
+{
+  (void)x;
+  return false;
+}
+/**
+   Clocks the next len bytes of the READ started by read_open() into buf.
+*/
+void SPIFlashTransport::read_next(uint8_t *buf, uint32_t len)
+{
+  (void)buf;
+  (void)len;
+}
+/**
+   Ends the READ started by read_open() by driving S# HIGH.
+*/
+void SPIFlashTransport::read_close(void)
+{
+}
+/**
+   Blocks until the write in progress (WIP) bit is 0, one READ STATUS REGISTER command per poll.
+   Returns the number of status bytes read. The hint expect_us is not used.
+*/
+uint32_t SPIFlashTransport::wait_ready(uint32_t expect_us)
+{
+  flash_xfer_t x;
+  uint8_t sreg;
+  uint32_t polls = 0;
+
+  (void)expect_us;
+  x.hdr[0] = SPI_READ_STATUS_REGISTER;
+  x.hdr_len = 1;
+  x.tx = NULL;
+  x.rx = &sreg;
+  x.len = 1;
+  do {
+    run(&x, 1);
+    polls++;
+  } while (FLASH_SREG_WRITE_IN_PROGRESS(sreg));
+  return polls;
+}
+/**
+   Microsecond time base of the statistics and of the power-down timing.
+*/
+uint32_t SPIFlashTransport::now_us(void)
+{
+#if defined(ARDUINO)
+  return micros();
+#elif defined(__unix__)
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+#else
+  return 0;
+#endif
+}
+/**
+   Waits us microseconds; used for the tDP and tRES delays of DEEP POWER-DOWN.
+*/
+void SPIFlashTransport::delay_us(uint32_t us)
+{
+#if defined(ARDUINO)
+  delayMicroseconds(us);
+#elif defined(__unix__)
+  struct timespec ts;
+  ts.tv_sec = us / 1000000UL;
+  ts.tv_nsec = (us % 1000000UL) * 1000;
+  nanosleep(&ts, NULL);
+#else
+  uint32_t start = now_us();
+  while (now_us() - start < us) {
+  }
+#endif
+}
+
+#ifdef ARDUINO
+
+SPIFlashSPI::SPIFlashSPI(uint8_t cspin, uint32_t clockHz)
+{
+  _cspin = cspin;
+  _clockHz = clockHz;
+}
+/**
+   Configures the CS pin (HIGH when idle) and the SPI bus.
+*/
+bool SPIFlashSPI::begin(void)
+{
+  pinMode(_cspin, OUTPUT);
+  digitalWrite(_cspin, HIGH);
+#if SPIFLASH_PORT_CS
+  _csport = portOutputRegister(digitalPinToPort(_cspin));
+  _csmask = digitalPinToBitMask(_cspin);
+#endif
+  SPI.begin();
+  if (_clockHz > F_CPU / 2) {
+    _clockHz = F_CPU / 2;
+  }
+#ifdef SPI_HAS_TRANSACTION
+  _settings = SPISettings(_clockHz, MSBFIRST, SPI_MODE0);
+#else
+  uint8_t div = 2;
+  while (div < 128 && F_CPU / div > _clockHz) {
+    div *= 2;
+  }
+  _clockHz = F_CPU / div;
+  SPI.setBitOrder(MSBFIRST);
+  SPI.setDataMode(SPI_MODE0);
+  switch (div) {
+    case 2: SPI.setClockDivider(SPI_CLOCK_DIV2); break;
+    case 4: SPI.setClockDivider(SPI_CLOCK_DIV4); break;
+    case 8: SPI.setClockDivider(SPI_CLOCK_DIV8); break;
+    case 16: SPI.setClockDivider(SPI_CLOCK_DIV16); break;
+    case 32: SPI.setClockDivider(SPI_CLOCK_DIV32); break;
+    case 64: SPI.setClockDivider(SPI_CLOCK_DIV64); break;
+    default: SPI.setClockDivider(SPI_CLOCK_DIV128); break;
+  }
+#endif
+  return true;
+}
+/**
+   Sends the header byte by byte, then the data: sent byte by byte, or received with one block transfer
+   that exchanges the buffer in place (the device ignores DQ0 during the data phase of a read).
+*/
+void SPIFlashSPI::run(const flash_xfer_t *xfers, uint8_t count)
+{
+  const flash_xfer_t *x;
+  uint32_t i;
+
+  for (x = xfers; x < xfers + count; x++) {
+    select();
+    for (i = 0; i < x->hdr_len; i++) {
+      SPI.transfer(x->hdr[i]);
+    }
+    if (x->tx != NULL) {
+      for (i = 0; i < x->len; i++) {
+        SPI.transfer(x->tx[i]);
+      }
+    } else if (x->rx != NULL && x->len > 0) {
+      SPI.transfer(x->rx, x->len);
+    }
+    deselect();
+  }
+}
+/**
+   One READ for the whole length; each chunk is exchanged in place and handed to sink while S# stays LOW.
+*/
+void SPIFlashSPI::read_stream(const flash_xfer_t *x, flash_sink_t sink, void *ctx)
+{
+  uint8_t chunk[SPIFLASH_STREAM_CHUNK];
+  uint32_t left = x->len;
+  uint32_t n;
+  uint8_t i;
+
+  select();
+  for (i = 0; i < x->hdr_len; i++) {
+    SPI.transfer(x->hdr[i]);
+  }
+  while (left > 0) {
+    n = (left < sizeof(chunk)) ? left : sizeof(chunk);
+    SPI.transfer(chunk, n);
+    sink(ctx, chunk, n);
+    left -= n;
+  }
+  deselect();
+}
+bool SPIFlashSPI::read_open(const flash_xfer_t *x)
+{
+  uint8_t i;
+  select();
+  for (i = 0; i < x->hdr_len; i++) {
+    SPI.transfer(x->hdr[i]);
+  }
+  return true;
+}
+void SPIFlashSPI::read_next(uint8_t *buf, uint32_t len)
+{
+  SPI.transfer(buf, len);
+}
+void SPIFlashSPI::read_close(void)
+{
+  deselect();
+}
+/**
+   Reads the status register continuously with a single READ STATUS REGISTER command.
+   A poll costs a byte time only, so the hint expect_us is not used.
+*/
+uint32_t SPIFlashSPI::wait_ready(uint32_t expect_us)
+{
+  uint32_t polls = 1;
+  (void)expect_us;
+  select();
+  SPI.transfer(SPI_READ_STATUS_REGISTER);
+  while (FLASH_SREG_WRITE_IN_PROGRESS(SPI.transfer(0))) {
+    polls++;
+  }
+  deselect();
+  return polls;
+}
+uint32_t SPIFlashSPI::clock_hz(void)
+{
+  return _clockHz;
+}
+
+#endif
+
+SPIFlashLoopback::SPIFlashLoopback(uint8_t *mem, uint32_t size)
+{
+  _mem = mem;
+  _size = size;
+  _wel = false;
+  _read_addr = 0;
+}
+void SPIFlashLoopback::run(const flash_xfer_t *xfers, uint8_t count)
+{
+  uint8_t i;
+  for (i = 0; i < count; i++) {
+    execute(&xfers[i]);
+  }
+}
+/**
+   Hands the array to sink directly, in pieces split where the address wraps.
+*/
+void SPIFlashLoopback::read_stream(const flash_xfer_t *x, flash_sink_t sink, void *ctx)
+{
+  uint32_t addr = (((uint32_t)x->hdr[1] << 16) | ((uint32_t)x->hdr[2] << 8) | x->hdr[3]) % _size;
+  uint32_t left = x->len;
+  uint32_t n;
+
+  while (left > 0) {
+    n = _size - addr;
+    if (n > left) {
+      n = left;
+    }
+    sink(ctx, &_mem[addr], n);
+    addr = (addr + n) % _size;
+    left -= n;
+  }
+}
+bool SPIFlashLoopback::read_open(const flash_xfer_t *x)
+{
+  _read_addr = (((uint32_t)x->hdr[1] << 16) | ((uint32_t)x->hdr[2] << 8) | x->hdr[3]) % _size;
+  return true;
+}
+void SPIFlashLoopback::read_next(uint8_t *buf, uint32_t len)
+{
+  while (len-- > 0) {
+    *buf++ = _mem[_read_addr];
+    _read_addr = (_read_addr + 1) % _size;
+  }
+}
+uint32_t SPIFlashLoopback::clock_hz(void)
+{
+  return flash_CLOCK_MAX_HZ;
+}
+void SPIFlashLoopback::execute(const flash_xfer_t *x)
+{
+  static const uint8_t id[4] = { 0x20, 0x20, 0x15, 0x00 };
+  uint32_t addr = 0;
+  uint32_t base;
+  uint32_t i;
+
+  if (x->hdr_len >= 4) {
+    addr = ((uint32_t)x->hdr[1] << 16) | ((uint32_t)x->hdr[2] << 8) | x->hdr[3];
+  }
+  switch (x->hdr[0]) {
+    case SPI_WRITE_ENABLE:
+      _wel = true;
+      break;
+    case SPI_WRITE_DISABLE:
+      _wel = false;
+      break;
+    case SPI_READ_STATUS_REGISTER:
+      for (i = 0; i < x->len && x->rx != NULL; i++) {
+        x->rx[i] = _wel ? 0x02 : 0x00;
+      }
+      break;
+    case SPI_READ_IDENTIFICATION:
+      for (i = 0; i < x->len && x->rx != NULL; i++) {
+        x->rx[i] = (i < sizeof(id)) ? id[i] : 0x00;
+      }
+      break;
+    case SPI_READ_DATA_BYTES:
+    case SPIFLASH_ARRAYREAD:
+      for (i = 0; i < x->len && x->rx != NULL; i++) {
+        x->rx[i] = _mem[(addr + i) % _size];
+      }
+      break;
+    case SPI_PAGE_PROGRAM:
+      if (_wel) {
+        base = addr - (addr % flash_PAGE_BYTE_SIZE);
+        for (i = 0; i < x->len; i++) {
+          _mem[(base + (addr + i) % flash_PAGE_BYTE_SIZE) % _size] &= x->tx[i];
+        }
+        _wel = false;
+      }
+      break;
+    case SPI_SECTOR_ERASE:
+      if (_wel) {
+        base = addr - (addr % flash_SECTOR_BYTE_SIZE);
+        for (i = 0; i < flash_SECTOR_BYTE_SIZE; i++) {
+          _mem[(base + i) % _size] = 0xFF;
+        }
+        _wel = false;
+      }
+      break;
+    case SPI_BULK_ERASE:
+      if (_wel) {
+        memset(_mem, 0xFF, _size);
+        _wel = false;
+      }
+      break;
+  }
+}
@@ -0,0 +1,203 @@
+// * Copyright (c) 2013 Shinichiro Nakamura (https://github.com/shintamainjp)
+// > Updated April. 7, 2016, George KC, Arduino version. (https://github.com/georgekc)
+// **********************************************************************************
+// License
+// **********************************************************************************
+// This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software
+// Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will
+// be useful, but WITHOUT ANY WARRANTY; without even the
+// implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public
+// License for more details.
+//
+// You should have received a copy of the GNU General
+// Public License along with this program.
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Licence can be viewed at
+// http://www.gnu.org/licenses/gpl-3.0.txt
+//
+// Please maintain this license information along with authorship
+// and copyright notices in any redistribution of this code
+
+
+#ifndef _SPIFLASH_TRANSPORT_H_
+#define _SPIFLASH_TRANSPORT_H_
+
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#include <SPI.h>
+#endif
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/// Highest clock frequency (fC) of every command but READ DATA BYTES, the default SPI clock.
+#define flash_CLOCK_MAX_HZ     (50000000UL)
+
+/// Longest command header: command code, three address bytes and a dummy byte.
+#define FLASH_XFER_HDR_MAX     (5)
+
+/// Bytes of the RAM chunk through which read_stream() hands the data to its sink.
+#ifndef SPIFLASH_STREAM_CHUNK
+#define SPIFLASH_STREAM_CHUNK  (32)
+#endif
+
+/**
+   @brief One command, framed by S# LOW ... HIGH.
+   @details
+   The header (command code, address, dummy byte) is followed by an optional data phase of len bytes,
+   either sent from tx or received into rx. At most one of tx and rx is set.
+*/
+typedef struct flash_xfer {
+  uint8_t hdr[FLASH_XFER_HDR_MAX];
+  uint8_t hdr_len;
+  const uint8_t *tx;
+  uint8_t *rx;
+  uint32_t len;
+} flash_xfer_t;
+
+/// Receives the data of SPIFlashTransport::read_stream() as it comes off the bus.
+typedef void (*flash_sink_t)(void *ctx, const uint8_t *data, uint32_t len);
+
+/**
+   @brief Link between SPIFlash and the device.
+   @details
+   run() executes a batch of commands in order, each one framed by its own S# pulse.
+   Commands that always go together (e.g. WRITE ENABLE and PAGE PROGRAM) are handed over as one batch,
+   so a backend with a per-call cost can send them in a single bus transaction.
+   read_stream() runs a READ whose data goes to a sink in small chunks instead of a caller buffer.
+   read_open() starts a READ and leaves S# LOW, so read_next() can fetch more data later without a new
+   command and address, until read_close(). Backends that cannot hold S# between calls return false from it.
+   wait_ready() is told how long the cycle in progress is still expected to take (0 when unknown),
+   so a backend for which every poll is expensive can sleep through it instead.
+*/
+class SPIFlashTransport {
+  public:
+    virtual ~SPIFlashTransport() {}
+    virtual bool begin(void);
+    virtual void run(const flash_xfer_t *xfers, uint8_t count) = 0;
+    virtual void read_stream(const flash_xfer_t *x, flash_sink_t sink, void *ctx);
+    virtual bool read_open(const flash_xfer_t *x);
+    virtual void read_next(uint8_t *buf, uint32_t len);
+    virtual void read_close(void);
+    virtual uint32_t wait_ready(uint32_t expect_us = 0);
+    virtual uint32_t clock_hz(void) = 0;
+    virtual uint32_t now_us(void);
+    virtual void delay_us(uint32_t us);
+};
+
+#ifdef ARDUINO
+
+/// On AVR, chip select is driven through the output port register and bit mask looked up once by begin().
+#if defined(__AVR__)
+#define SPIFLASH_PORT_CS       (1)
+#else
+#define SPIFLASH_PORT_CS       (0)
+#endif
+
+/**
+   @brief Arduino SPI library backend.
+   @details
+   Every command runs inside SPI.beginTransaction()/endTransaction() with the settings prepared by begin(),
+   mode 0, MSB first, at the requested clock capped at F_CPU / 2. Cores without SPI transactions are configured
+   once, globally, at the closest divider. wait_ready() keeps S# LOW and reads the status register continuously,
+   and read_stream() keeps it LOW for the whole READ. Between read_open() and read_close() the SPI transaction
+   stays open, so other devices on the bus must wait for read_close().
+*/
+class SPIFlashSPI : public SPIFlashTransport {
+  public:
+    SPIFlashSPI(uint8_t cspin, uint32_t clockHz = flash_CLOCK_MAX_HZ);
+    bool begin(void);
+    void run(const flash_xfer_t *xfers, uint8_t count);
+    void read_stream(const flash_xfer_t *x, flash_sink_t sink, void *ctx);
+    bool read_open(const flash_xfer_t *x);
+    void read_next(uint8_t *buf, uint32_t len);
+    void read_close(void);
+    uint32_t wait_ready(uint32_t expect_us = 0);
+    uint32_t clock_hz(void);
+  protected:
+    inline void select(void);
+    inline void deselect(void);
+
+    uint8_t _cspin;
+    uint32_t _clockHz;
+#ifdef SPI_HAS_TRANSACTION
+    SPISettings _settings;
+#endif
+#if SPIFLASH_PORT_CS
+    volatile uint8_t *_csport;
+    uint8_t _csmask;
+#endif
+
+};
+
+#endif
+
+/**
+   @brief In-memory loopback backend.
+   @details
+   Decodes the commands against a RAM buffer of size bytes standing in for the array,
+   so code built on SPIFlash can be tested without a device. Addresses wrap at size.
+   WRITE ENABLE, PAGE PROGRAM (with page wrap, 1 to 0 only), SECTOR ERASE, BULK ERASE, both READs,
+   READ STATUS REGISTER and READ IDENTIFICATION are supported; cycles complete at once, so WIP is always 0.
+*/
+class SPIFlashLoopback : public SPIFlashTransport {
+  public:
+    SPIFlashLoopback(uint8_t *mem, uint32_t size);
+    void run(const flash_xfer_t *xfers, uint8_t count);
+    void read_stream(const flash_xfer_t *x, flash_sink_t sink, void *ctx);
+    bool read_open(const flash_xfer_t *x);
+    void read_next(uint8_t *buf, uint32_t len);
+    uint32_t clock_hz(void);
+  protected:
+    void execute(const flash_xfer_t *x);
+
+    uint8_t *_mem;
+    uint32_t _size;
+    bool _wel;
+    uint32_t _read_addr;          // next address of the READ left open by read_open()
+
+};
+
+#ifdef ARDUINO
+/**
+   Drives S# LOW, inside an SPI transaction with the settings of begin().
+*/
+inline void SPIFlashSPI::select(void)
+{
+#ifdef SPI_HAS_TRANSACTION
+  SPI.beginTransaction(_settings);
+#endif
+#if SPIFLASH_PORT_CS
+  uint8_t sreg = SREG;
+  cli();
+  *_csport &= ~_csmask;
+  SREG = sreg;
+#else
+  digitalWrite(_cspin, LOW);
+#endif
+}
+inline void SPIFlashSPI::deselect(void)
+{
+#if SPIFLASH_PORT_CS
+  uint8_t sreg = SREG;
+  cli();
+  *_csport |= _csmask;
+  SREG = sreg;
+#else
+  digitalWrite(_cspin, HIGH);
+#endif
+#ifdef SPI_HAS_TRANSACTION
+  SPI.endTransaction();
+#endif
+}
+#endif
+
+#endif
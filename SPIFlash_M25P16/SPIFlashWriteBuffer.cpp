@@ -0,0 +1,120 @@
+// * Copyright (c) 2013 Shinichiro Nakamura (https://github.com/shintamainjp)
+// > Updated April. 7, 2016, George KC,Arduino version. (https://github.com/georgekc)
+// **********************************************************************************
+// License
+// **********************************************************************************
+// This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software
+// Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will
+// be useful, but WITHOUT ANY WARRANTY; without even the
+// implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public
+// License for more details.
+//
+// You should have received a copy of the GNU General
+// Public License along with this program.
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Licence can be viewed at
+// http://www.gnu.org/licenses/gpl-3.0.txt
+//
+// Please maintain this license information along with authorship
+// and copyright notices in any redistribution of this code
+
+#include "SPIFlashWriteBuffer.h"
+
+SPIFlashWriteBuffer::SPIFlashWriteBuffer(SPIFlash &flash) : _flash(flash)
+{
+  _page = 0;
+  _lo = 0;
+  _hi = 0;
+}
+/**
+   @brief Write.
+   @details
+   Buffers len bytes at addr. The target area must be erased (or only need 1 to 0 transitions).
+   A write spanning several pages flushes each page as soon as the buffered range covers all of it.
+*/
+void SPIFlashWriteBuffer::write(uint32_t addr, const uint8_t *buf, uint32_t len)
+{
+  uint32_t page;
+  uint16_t off;
+  uint16_t n;
+  uint16_t i;
+
+  while (len > 0) {
+    page = addr - (addr % flash_PAGE_BYTE_SIZE);
+    off = addr % flash_PAGE_BYTE_SIZE;
+    n = flash_PAGE_BYTE_SIZE - off;
+    if (n > len) {
+      n = len;
+    }
+    if (dirty() && page != _page) {
+      flush();
+    }
+    if (!dirty()) {
+      memset(_data, 0xFF, sizeof(_data));
+      _page = page;
+      _lo = off;
+      _hi = off;
+    }
+    for (i = 0; i < n; i++) {
+      _data[off + i] &= buf[i];
+    }
+    if (off < _lo) {
+      _lo = off;
+    }
+    if (off + n > _hi) {
+      _hi = off + n;
+    }
+    if (_lo == 0 && _hi == flash_PAGE_BYTE_SIZE) {
+      flush();
+    }
+    addr += n;
+    buf += n;
+    len -= n;
+  }
+}
+/**
+   @brief Read.
+   @details
+   Reads len bytes at addr from the device and applies any buffered, not yet programmed, data on top.
+*/
+void SPIFlashWriteBuffer::read(uint32_t addr, uint8_t *buf, uint32_t len)
+{
+  uint32_t i;
+  uint32_t off;
+
+  _flash.flash_read_data_bytes(addr, buf, len);
+  if (!dirty()) {
+    return;
+  }
+  for (i = 0; i < len; i++) {
+    off = addr + i - _page;
+    if (off >= _lo && off < _hi) {
+      buf[i] &= _data[off];
+    }
+  }
+}
+/**
+   @brief Flush.
+   @details
+   Programs the buffered range, if any, with one PAGE PROGRAM and waits for it to complete.
+*/
+void SPIFlashWriteBuffer::flush(void)
+{
+  if (!dirty()) {
+    return;
+  }
+  _flash.flash_write(_page + _lo, &_data[_lo], _hi - _lo);
+  _lo = 0;
+  _hi = 0;
+}
+bool SPIFlashWriteBuffer::dirty(void)
+{
+  return _hi != _lo;
+}
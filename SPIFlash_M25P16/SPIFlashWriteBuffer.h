@@ -0,0 +1,64 @@
+// * Copyright (c) 2013 Shinichiro Nakamura (https://github.com/shintamainjp)
+// > Updated April. 7, 2016, George KC, Arduino version. (https://github.com/georgekc)
+// **********************************************************************************
+// License
+// **********************************************************************************
+// This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software
+// Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will
+// be useful, but WITHOUT ANY WARRANTY; without even the
+// implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public
+// License for more details.
+//
+// You should have received a copy of the GNU General
+// Public License along with this program.
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Licence can be viewed at
+// http://www.gnu.org/licenses/gpl-3.0.txt
+//
+// Please maintain this license information along with authorship
+// and copyright notices in any redistribution of this code
+
+#ifndef _SPIFLASH_WRITE_BUFFER_H_
+#define _SPIFLASH_WRITE_BUFFER_H_
+
+
+#include "SPIFlash.h"
+
+/**
+   @brief Write-coalescing page buffer.
+   @details
+   Gathers small writes aimed at the same 256-byte page in RAM and programs them
+   with a single PAGE PROGRAM (through SPIFlash::flash_write()) when:
+   - the buffered range covers the whole page,
+   - a write goes to a different page, or
+   - flush() is called.
+   Buffered bytes are combined with AND, exactly as programming the same byte twice
+   would combine them on the device, and gaps inside the buffered range are sent as FFh,
+   which leaves the corresponding memory bytes unchanged.
+   read() overlays the buffered data on the device contents so reads stay coherent.
+*/
+class SPIFlashWriteBuffer {
+  public:
+    SPIFlashWriteBuffer(SPIFlash &flash);
+    void write(uint32_t addr, const uint8_t *buf, uint32_t len);
+    void read(uint32_t addr, uint8_t *buf, uint32_t len);
+    void flush(void);
+    bool dirty(void);
+  protected:
+
+    SPIFlash &_flash;
+    uint8_t _data[flash_PAGE_BYTE_SIZE];
+    uint32_t _page;  // address of the first byte of the buffered page
+    uint16_t _lo;    // buffered range is [_lo, _hi) within the page, empty when equal
+    uint16_t _hi;
+
+};
+
+#endif
@@ -0,0 +1,67 @@
+#include <Arduino.h>
+#include "SPIFlash.h"
+
+#define FLASH_CS      8
+#define BENCH_BYTES   (32768UL)
+#define CHUNK_BYTES   (256)
+
+
+SPIFlash flash(FLASH_CS);
+
+uint8_t chunk[CHUNK_BYTES];
+
+// The READ DATA BYTES loop as it was before block transfers: one SPI.transfer() per byte.
+// READ (03h) is only specified up to fR, so the baseline runs at flash_READ_MAX_HZ.
+void read_per_byte(uint32_t addr, uint8_t *buf, uint32_t siz)
+{
+  uint32_t i;
+  SPI.beginTransaction(SPISettings(flash_READ_MAX_HZ, MSBFIRST, SPI_MODE0));
+  digitalWrite(FLASH_CS, LOW);
+  SPI.transfer(SPI_READ_DATA_BYTES);
+  SPI.transfer(addr >> 16);
+  SPI.transfer(addr >>  8);
+  SPI.transfer(addr >>  0);
+  for (i = 0; i < siz; i++) {
+    buf[i] = SPI.transfer(0);
+  }
+  digitalWrite(FLASH_CS, HIGH);
+  SPI.endTransaction();
+}
+
+void report(const char *name, unsigned long us)
+{
+  Serial.print(name);
+  Serial.print(us);
+  Serial.print(" us, ");
+  Serial.print((BENCH_BYTES * 1000UL) / us);
+  Serial.println(" KB/s");
+}
+
+void setup() {
+  uint32_t addr;
+  unsigned long start;
+
+  Serial.begin(115200);
+  Serial.println("M25P16 read benchmark");
+
+  start = micros();
+  for (addr = 0; addr < BENCH_BYTES; addr += CHUNK_BYTES) {
+    read_per_byte(addr, chunk, CHUNK_BYTES);
+  }
+  report("per-byte READ     : ", micros() - start);
+
+  start = micros();
+  for (addr = 0; addr < BENCH_BYTES; addr += CHUNK_BYTES) {
+    flash.flash_read_data_bytes(addr, chunk, CHUNK_BYTES);
+  }
+  report("block READ        : ", micros() - start);
+
+  start = micros();
+  for (addr = 0; addr < BENCH_BYTES; addr += CHUNK_BYTES) {
+    flash.flash_fast_read_data_bytes(addr, chunk, CHUNK_BYTES);
+  }
+  report("block FAST_READ   : ", micros() - start);
+}
+
+void loop() {
+}
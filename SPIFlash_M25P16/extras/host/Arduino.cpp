@@ -0,0 +1,217 @@
+// * Copyright (c) 2013 Shinichiro Nakamura (https://github.com/shintamainjp)
+// > Updated April. 7, 2016, George KC,Arduino version. (https://github.com/georgekc)
+// **********************************************************************************
+// License
+// **********************************************************************************
+// This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software
+// Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will
+// be useful, but WITHOUT ANY WARRANTY; without even the
+// implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public
+// License for more details.
+//
+// You should have received a copy of the GNU General
+// Public License along with this program.
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Licence can be viewed at
+// http://www.gnu.org/licenses/gpl-3.0.txt
+//
+// Please maintain this license information along with authorship
+// and copyright notices in any redistribution of this code
+
+
+#include <stdio.h>
+#include <Arduino.h>
+#include <SPI.h>
+#include "M25P16Sim.h"
+
+SPIClass SPI;
+HardwareSerial Serial;
+
+// AVR-like defaults: a 16 MHz MCU calling SPI.transfer() and digitalWrite(); an SBC for spidev.
+sim_host_timing_t sim_host_timing = { 500, 125, 3400, 20000 };
+
+static uint8_t pin_level[256];
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+  (void)pin;
+  (void)mode;
+}
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+  M25P16Sim *dev;
+
+  sim_advance_ns(sim_host_timing.gpio_ns);
+  pin_level[pin] = val;
+  dev = M25P16Sim::find(pin);
+  if (dev != NULL) {
+    if (val == LOW) {
+      dev->select();
+    } else {
+      dev->deselect();
+    }
+  }
+}
+int digitalRead(uint8_t pin)
+{
+  return pin_level[pin];
+}
+unsigned long millis(void)
+{
+  return sim_now_ns() / 1000000ULL;
+}
+unsigned long micros(void)
+{
+  return sim_now_ns() / 1000ULL;
+}
+void delay(unsigned long ms)
+{
+  sim_advance_ns((uint64_t)ms * 1000000ULL);
+}
+void delayMicroseconds(unsigned int us)
+{
+  sim_advance_ns((uint64_t)us * 1000ULL);
+}
+
+size_t Print::write(const uint8_t *buf, size_t size)
+{
+  size_t i;
+  for (i = 0; i < size; i++) {
+    write(buf[i]);
+  }
+  return size;
+}
+size_t Stream::readBytes(uint8_t *buf, size_t length)
+{
+  size_t n = 0;
+  int c;
+  while (n < length && (c = read()) >= 0) {
+    buf[n++] = (uint8_t)c;
+  }
+  return n;
+}
+size_t Print::print(const char *s)
+{
+  return write((const uint8_t *)s, strlen(s));
+}
+size_t Print::print(char c)
+{
+  return write((uint8_t)c);
+}
+size_t Print::print(unsigned char n, int base)
+{
+  return print_number(n, base);
+}
+size_t Print::print(int n, int base)
+{
+  return print((long)n, base);
+}
+size_t Print::print(unsigned int n, int base)
+{
+  return print_number(n, base);
+}
+size_t Print::print(long n, int base)
+{
+  if (n < 0 && base == DEC) {
+    return print('-') + print_number(-(unsigned long)n, base);
+  }
+  return print_number((unsigned long)n, base);
+}
+size_t Print::print(unsigned long n, int base)
+{
+  return print_number(n, base);
+}
+size_t Print::println(void)
+{
+  return print("\r\n");
+}
+size_t Print::print_number(unsigned long n, int base)
+{
+  char digits[sizeof(unsigned long) * 8 + 1];
+  char *p = &digits[sizeof(digits) - 1];
+
+  *p = '\0';
+  do {
+    *--p = "0123456789ABCDEF"[n % base];
+    n /= base;
+  } while (n != 0);
+  return print(p);
+}
+
+void HardwareSerial::begin(unsigned long baud)
+{
+  (void)baud;
+}
+size_t HardwareSerial::write(uint8_t c)
+{
+  return fputc(c, stdout) == EOF ? 0 : 1;
+}
+
+SPIClass::SPIClass(void)
+{
+  _clockHz = F_CPU / 4;
+  _bitOrder = MSBFIRST;
+  _dataMode = SPI_MODE0;
+}
+void SPIClass::begin(void)
+{
+}
+void SPIClass::end(void)
+{
+}
+/**
+   Picks the fastest power-of-two divider of F_CPU that does not exceed the requested clock, like the AVR core.
+*/
+void SPIClass::beginTransaction(SPISettings settings)
+{
+  uint32_t div = 2;
+  while (div < 128 && F_CPU / div > settings._clock) {
+    div *= 2;
+  }
+  _clockHz = F_CPU / div;
+  _bitOrder = settings._bitOrder;
+  _dataMode = settings._dataMode;
+}
+void SPIClass::endTransaction(void)
+{
+}
+void SPIClass::setBitOrder(uint8_t bitOrder)
+{
+  _bitOrder = bitOrder;
+}
+void SPIClass::setDataMode(uint8_t dataMode)
+{
+  _dataMode = dataMode;
+}
+void SPIClass::setClockDivider(uint8_t div)
+{
+  static const uint8_t shift[] = { 2, 4, 6, 7, 1, 3, 5, 2 };
+  _clockHz = F_CPU >> shift[div & 0x07];
+}
+uint8_t SPIClass::transfer(uint8_t data)
+{
+  sim_advance_ns(sim_host_timing.spi_call_ns + 8000000000ULL / _clockHz);
+  return M25P16Sim::exchange(data, _clockHz);
+}
+void SPIClass::transfer(void *buf, size_t count)
+{
+  uint8_t *p = (uint8_t *)buf;
+  size_t i;
+
+  sim_advance_ns(sim_host_timing.spi_call_ns);
+  for (i = 0; i < count; i++) {
+    sim_advance_ns(sim_host_timing.spi_byte_ns + 8000000000ULL / _clockHz);
+    p[i] = M25P16Sim::exchange(p[i], _clockHz);
+  }
+}
+uint32_t SPIClass::clock_hz(void)
+{
+  return _clockHz;
+}
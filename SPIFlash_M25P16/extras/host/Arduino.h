@@ -0,0 +1,111 @@
+// * Copyright (c) 2013 Shinichiro Nakamura (https://github.com/shintamainjp)
+// > Updated April. 7, 2016, George KC, Arduino version. (https://github.com/georgekc)
+// **********************************************************************************
+// License
+// **********************************************************************************
+// This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software
+// Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will
+// be useful, but WITHOUT ANY WARRANTY; without even the
+// implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public
+// License for more details.
+//
+// You should have received a copy of the GNU General
+// Public License along with this program.
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Licence can be viewed at
+// http://www.gnu.org/licenses/gpl-3.0.txt
+//
+// Please maintain this license information along with authorship
+// and copyright notices in any redistribution of this code
+
+
+#ifndef _HOST_ARDUINO_H_
+#define _HOST_ARDUINO_H_
+
+/// Stand-in for the Arduino core used by the host (Linux) build of the library.
+/// Pins and time are simulated: micros()/millis() read the virtual clock of M25P16Sim.h,
+/// and driving a chip select pin LOW selects the simulated device attached to it.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef F_CPU
+#define F_CPU 16000000UL
+#endif
+
+#define HIGH         (1)
+#define LOW          (0)
+#define INPUT        (0)
+#define OUTPUT       (1)
+#define INPUT_PULLUP (2)
+
+#define LSBFIRST     (0)
+#define MSBFIRST     (1)
+
+#define DEC          (10)
+#define HEX          (16)
+#define BIN          (2)
+
+#define F(s)         (s)
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+class Print {
+  public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buf, size_t size);
+    virtual void flush(void) {}
+    size_t print(const char *s);
+    size_t print(char c);
+    size_t print(unsigned char n, int base = DEC);
+    size_t print(int n, int base = DEC);
+    size_t print(unsigned int n, int base = DEC);
+    size_t print(long n, int base = DEC);
+    size_t print(unsigned long n, int base = DEC);
+    size_t println(void);
+    template <typename T> size_t println(T v) { size_t n = print(v); return n + println(); }
+    template <typename T> size_t println(T v, int base) { size_t n = print(v, base); return n + println(); }
+  protected:
+    size_t print_number(unsigned long n, int base);
+};
+
+/// Input side of the core's Stream, without the timeout handling: readBytes() stops at the first read() of -1.
+class Stream : public Print {
+  public:
+    virtual int available(void) = 0;
+    virtual int read(void) = 0;
+    virtual int peek(void) = 0;
+    size_t readBytes(uint8_t *buf, size_t length);
+    size_t readBytes(char *buf, size_t length) { return readBytes((uint8_t *)buf, length); }
+};
+
+/// Serial writes to stdout on the host.
+class HardwareSerial : public Print {
+  public:
+    void begin(unsigned long baud);
+    size_t write(uint8_t c);
+    using Print::write;
+};
+
+extern HardwareSerial Serial;
+
+#endif
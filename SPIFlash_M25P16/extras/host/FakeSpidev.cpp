@@ -0,0 +1,78 @@
+// * Copyright (c) 2013 Shinichiro Nakamura (https://github.com/shintamainjp)
+// > Updated April. 7, 2016, George KC,Arduino version. (https://github.com/georgekc)
+// **********************************************************************************
+// License
+// **********************************************************************************
+// This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software
+// Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will
+// be useful, but WITHOUT ANY WARRANTY; without even the
+// implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public
+// License for more details.
+//
+// You should have received a copy of the GNU General
+// Public License along with this program.
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Licence can be viewed at
+// http://www.gnu.org/licenses/gpl-3.0.txt
+//
+// Please maintain this license information along with authorship
+// and copyright notices in any redistribution of this code
+
+
+#include "FakeSpidev.h"
+
+#if defined(__linux__) && !defined(ARDUINO)
+
+FakeSpidev::FakeSpidev(M25P16Sim &device, uint32_t speed_hz) : SPIFlashSpidev("fake", speed_hz), _device(device)
+{
+}
+bool FakeSpidev::begin(void)
+{
+  return true;
+}
+uint32_t FakeSpidev::now_us(void)
+{
+  return sim_now_ns() / 1000;
+}
+void FakeSpidev::delay_us(uint32_t us)
+{
+  sim_advance_ns((uint64_t)us * 1000);
+}
+int FakeSpidev::message(struct spi_ioc_transfer *xfers, unsigned count)
+{
+  const uint8_t *tx;
+  uint8_t *rx;
+  uint32_t total = 0;
+  uint32_t i;
+  unsigned k;
+
+  sim_advance_ns(sim_host_timing.syscall_ns);
+  for (k = 0; k < count; k++) {
+    tx = (const uint8_t *)(unsigned long)xfers[k].tx_buf;
+    rx = (uint8_t *)(unsigned long)xfers[k].rx_buf;
+    _device.select();
+    for (i = 0; i < xfers[k].len; i++) {
+      sim_advance_ns(8000000000ULL / xfers[k].speed_hz);
+      uint8_t miso = M25P16Sim::exchange((tx != NULL) ? tx[i] : 0, xfers[k].speed_hz);
+      if (rx != NULL) {
+        rx[i] = miso;
+      }
+    }
+    total += xfers[k].len;
+    sim_advance_ns((uint64_t)xfers[k].delay_usecs * 1000);
+    // cs_change deselects between transfers, and keeps S# LOW after the last one.
+    if ((k + 1 < count) == (xfers[k].cs_change != 0)) {
+      _device.deselect();
+    }
+  }
+  return total;
+}
+
+#endif
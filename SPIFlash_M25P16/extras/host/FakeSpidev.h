@@ -0,0 +1,60 @@
+// * Copyright (c) 2013 Shinichiro Nakamura (https://github.com/shintamainjp)
+// > Updated April. 7, 2016, George KC, Arduino version. (https://github.com/georgekc)
+// **********************************************************************************
+// License
+// **********************************************************************************
+// This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software
+// Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will
+// be useful, but WITHOUT ANY WARRANTY; without even the
+// implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public
+// License for more details.
+//
+// You should have received a copy of the GNU General
+// Public License along with this program.
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Licence can be viewed at
+// http://www.gnu.org/licenses/gpl-3.0.txt
+//
+// Please maintain this license information along with authorship
+// and copyright notices in any redistribution of this code
+
+
+#ifndef _FAKE_SPIDEV_H_
+#define _FAKE_SPIDEV_H_
+
+
+#include "SPIFlashSpidev.h"
+#include "M25P16Sim.h"
+
+#if defined(__linux__) && !defined(ARDUINO)
+
+/**
+   @brief SPIFlashSpidev with the ioctl replaced by the simulated device.
+   @details
+   Each SPI_IOC_MESSAGE charges sim_host_timing.syscall_ns to the virtual clock, then clocks every
+   transfer into the device, driving S# as the spidev driver does (cs_change between transfers)
+   and waiting delay_usecs after each transfer.
+*/
+class FakeSpidev : public SPIFlashSpidev {
+  public:
+    FakeSpidev(M25P16Sim &device, uint32_t speed_hz = flash_CLOCK_MAX_HZ);
+    bool begin(void);
+    uint32_t now_us(void);
+    void delay_us(uint32_t us);
+  protected:
+    int message(struct spi_ioc_transfer *xfers, unsigned count);
+
+    M25P16Sim &_device;
+
+};
+
+#endif
+
+#endif
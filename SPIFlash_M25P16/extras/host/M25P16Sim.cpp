@@ -0,0 +1,358 @@
+// * Copyright (c) 2013 Shinichiro Nakamura (https://github.com/shintamainjp)
+// > Updated April. 7, 2016, George KC,Arduino version. (https://github.com/georgekc)
+// **********************************************************************************
+// License
+// **********************************************************************************
+// This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software
+// Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will
+// be useful, but WITHOUT ANY WARRANTY; without even the
+// implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public
+// License for more details.
+//
+// You should have received a copy of the GNU General
+// Public License along with this program.
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Licence can be viewed at
+// http://www.gnu.org/licenses/gpl-3.0.txt
+//
+// Please maintain this license information along with authorship
+// and copyright notices in any redistribution of this code
+
+
+#include "M25P16Sim.h"
+
+#define SIM_WREN   (0x06)
+#define SIM_WRDI   (0x04)
+#define SIM_RDID   (0x9F)
+#define SIM_RDSR   (0x05)
+#define SIM_WRSR   (0x01)
+#define SIM_READ   (0x03)
+#define SIM_FREAD  (0x0B)
+#define SIM_PP     (0x02)
+#define SIM_SE     (0xD8)
+#define SIM_BE     (0xC7)
+#define SIM_DP     (0xB9)
+#define SIM_RES    (0xAB)
+
+#define SIM_SR_WEL (0x02)
+#define SIM_SR_NV  (0x9C)   // SRWD, BP2, BP1, BP0
+
+static uint64_t clock_ns;
+static M25P16Sim *devices[M25P16_SIM_MAX_DEVICES];
+
+uint64_t sim_now_ns(void)
+{
+  return clock_ns;
+}
+void sim_advance_ns(uint64_t ns)
+{
+  clock_ns += ns;
+}
+
+M25P16Sim::M25P16Sim(uint8_t cspin)
+{
+  uint8_t i;
+
+  _cspin = cspin;
+  _mem = (uint8_t *)malloc(M25P16_SIM_ARRAY_SIZE);
+  memset(_mem, 0xFF, M25P16_SIM_ARRAY_SIZE);
+  _sr = 0;
+  memset(&stats, 0, sizeof(stats));
+  drop_wren = 0;
+  timing.tPP_base_ns = 160000;
+  timing.tPP_byte_ns = 1875;
+  timing.tW_ns = 1300000;
+  timing.tSE_us = 600000;
+  timing.tBE_us = 13000000;
+  timing.tDP_ns = 3000;
+  timing.tRES_ns = 30000;
+  timing.fR_hz = 20000000;  // M25P16 datasheet fR and fC, as flash_READ_MAX_HZ and flash_CLOCK_MAX_HZ
+  timing.fC_hz = 50000000;
+  power_cycle();
+  for (i = 0; i < M25P16_SIM_MAX_DEVICES; i++) {
+    if (devices[i] == NULL) {
+      devices[i] = this;
+      break;
+    }
+  }
+}
+M25P16Sim::~M25P16Sim()
+{
+  uint8_t i;
+  for (i = 0; i < M25P16_SIM_MAX_DEVICES; i++) {
+    if (devices[i] == this) {
+      devices[i] = NULL;
+    }
+  }
+  free(_mem);
+}
+/**
+   Returns the device attached to cspin, or NULL.
+*/
+M25P16Sim *M25P16Sim::find(uint8_t cspin)
+{
+  uint8_t i;
+  for (i = 0; i < M25P16_SIM_MAX_DEVICES; i++) {
+    if (devices[i] != NULL && devices[i]->_cspin == cspin) {
+      return devices[i];
+    }
+  }
+  return NULL;
+}
+/**
+   Clocks one byte into every selected device. MISO floats HIGH when no device drives it.
+*/
+uint8_t M25P16Sim::exchange(uint8_t mosi, uint32_t hz)
+{
+  uint8_t miso = 0xFF;
+  uint8_t i;
+  for (i = 0; i < M25P16_SIM_MAX_DEVICES; i++) {
+    if (devices[i] != NULL && devices[i]->_selected) {
+      miso &= devices[i]->transfer(mosi, hz);
+    }
+  }
+  return miso;
+}
+void M25P16Sim::select(void)
+{
+  if (_selected) {
+    return;
+  }
+  _selected = true;
+  _ignore = false;
+  _count = 0;
+  _addr = 0;
+  _page_n = 0;
+  memset(_page, 0xFF, sizeof(_page));
+  stats.selects++;
+}
+/**
+   S# HIGH: executes the command that was clocked in, if it is complete.
+*/
+void M25P16Sim::deselect(void)
+{
+  uint32_t base;
+  uint32_t i;
+  uint32_t n;
+
+  if (!_selected) {
+    return;
+  }
+  _selected = false;
+  if (_ignore || _count == 0) {
+    return;
+  }
+  switch (_cmd) {
+    case SIM_WREN:
+      if (_count == 1 && drop_wren > 0) {
+        drop_wren--;
+      } else if (_count == 1) {
+        _sr |= SIM_SR_WEL;
+      }
+      break;
+    case SIM_WRDI:
+      if (_count == 1) {
+        _sr &= ~SIM_SR_WEL;
+      }
+      break;
+    case SIM_WRSR:
+      if (_count == 2 && (_sr & SIM_SR_WEL)) {
+        _sr = _sr_new & SIM_SR_NV;
+        start_cycle(timing.tW_ns);
+      }
+      break;
+    case SIM_PP:
+      if (_count >= 5 && (_sr & SIM_SR_WEL) && !protected_addr(_addr)) {
+        base = _addr & ~0xFFUL;
+        for (i = 0; i < 256; i++) {
+          _mem[base + i] &= _page[i];
+        }
+        n = (_page_n < 256) ? _page_n : 256;
+        stats.programs++;
+        stats.program_bytes += n;
+        _sr &= ~SIM_SR_WEL;
+        start_cycle(timing.tPP_base_ns + (uint64_t)n * timing.tPP_byte_ns);
+      }
+      break;
+    case SIM_SE:
+      if (_count == 4 && (_sr & SIM_SR_WEL) && !protected_addr(_addr)) {
+        memset(&_mem[_addr & ~0xFFFFUL], 0xFF, 65536);
+        stats.sector_erases++;
+        _sr &= ~SIM_SR_WEL;
+        start_cycle((uint64_t)timing.tSE_us * 1000);
+      }
+      break;
+    case SIM_BE:
+      if (_count == 1 && (_sr & SIM_SR_WEL) && (_sr & 0x1C) == 0) {
+        memset(_mem, 0xFF, M25P16_SIM_ARRAY_SIZE);
+        stats.bulk_erases++;
+        _sr &= ~SIM_SR_WEL;
+        start_cycle((uint64_t)timing.tBE_us * 1000);
+      }
+      break;
+    case SIM_DP:
+      if (_count == 1) {
+        _dp_at = sim_now_ns() + timing.tDP_ns;
+      }
+      break;
+    case SIM_RES:
+      if (_dp_at != 0) {
+        _dp_at = 0;
+        _ready_at = sim_now_ns() + timing.tRES_ns;
+      }
+      break;
+  }
+}
+/**
+   Clocks one byte into the device at hz and returns the byte it drives on DQ1.
+*/
+uint8_t M25P16Sim::transfer(uint8_t mosi, uint32_t hz)
+{
+  uint32_t k;
+
+  if (!_selected) {
+    return 0xFF;
+  }
+  k = _count++;
+  if (k == 0) {
+    _cmd = mosi;
+    if (hz > timing.fC_hz) {
+      violation();
+    }
+    if (_dp_at != 0) {
+      _ignore = mosi != SIM_RES;
+    } else if (sim_now_ns() < _ready_at) {
+      _ignore = true;
+    } else if (busy()) {
+      _ignore = mosi != SIM_RDSR;
+    }
+    if (_ignore) {
+      violation();
+      return 0xFF;
+    }
+    switch (mosi) {
+      case SIM_READ:
+        if (hz > timing.fR_hz) {
+          violation();
+        }
+        stats.reads++;
+        break;
+      case SIM_FREAD:
+        stats.reads++;
+        break;
+      case SIM_RDSR:
+        stats.status_reads++;
+        break;
+    }
+    return 0xFF;
+  }
+  if (_ignore) {
+    return 0xFF;
+  }
+  switch (_cmd) {
+    case SIM_RDSR:
+      return status();
+    case SIM_RDID:
+      switch (k) {
+        case 1: return 0x20;  // manufacturer
+        case 2: return 0x20;  // memory type
+        case 3: return 0x15;  // memory capacity
+        case 4: return 0x10;  // UID length
+        default: return 0x00;
+      }
+    case SIM_WRSR:
+      if (k == 1) {
+        _sr_new = mosi;
+      }
+      return 0xFF;
+    case SIM_READ:
+    case SIM_FREAD:
+      if (k <= 3) {
+        _addr = ((_addr << 8) | mosi) % M25P16_SIM_ARRAY_SIZE;
+        return 0xFF;
+      }
+      if (_cmd == SIM_FREAD && k == 4) {
+        return 0xFF;  // dummy byte
+      }
+      stats.read_bytes++;
+      k = _mem[_addr];
+      _addr = (_addr + 1) % M25P16_SIM_ARRAY_SIZE;
+      return k;
+    case SIM_PP:
+      if (k <= 3) {
+        _addr = ((_addr << 8) | mosi) % M25P16_SIM_ARRAY_SIZE;
+        return 0xFF;
+      }
+      // Data beyond the end of the page wraps to its start; the last 256 bytes win.
+      _page[(_addr + _page_n) & 0xFF] = mosi;
+      _page_n++;
+      return 0xFF;
+    case SIM_SE:
+      if (k <= 3) {
+        _addr = ((_addr << 8) | mosi) % M25P16_SIM_ARRAY_SIZE;
+      }
+      return 0xFF;
+    case SIM_RES:
+      return (k >= 4) ? 0x14 : 0xFF;  // electronic signature after 3 dummy bytes
+  }
+  return 0xFF;
+}
+/**
+   WIP: true while a self-timed cycle is in progress.
+*/
+bool M25P16Sim::busy(void)
+{
+  return sim_now_ns() < _busy_until;
+}
+bool M25P16Sim::deep_power_down(void)
+{
+  return _dp_at != 0 && sim_now_ns() >= _dp_at;
+}
+/**
+   Power loss: keeps the array and the non-volatile status bits, aborts everything else.
+*/
+void M25P16Sim::power_cycle(void)
+{
+  _sr &= SIM_SR_NV;
+  _busy_until = 0;
+  _dp_at = 0;
+  _ready_at = 0;
+  _selected = false;
+  _ignore = false;
+  _count = 0;
+}
+uint8_t *M25P16Sim::array(void)
+{
+  return _mem;
+}
+bool M25P16Sim::protected_addr(uint32_t addr)
+{
+  uint8_t bp = (_sr >> 2) & 0x07;
+  if (bp == 0) {
+    return false;
+  }
+  if (bp >= 6) {
+    return true;
+  }
+  // BP = 1..5 protects the upper 1/32, 1/16, 1/8, 1/4 or 1/2 of the 32 sectors.
+  return (addr >> 16) >= (uint32_t)(32 - (1 << (bp - 1)));
+}
+uint8_t M25P16Sim::status(void)
+{
+  return _sr | (busy() ? 0x01 : 0x00);
+}
+void M25P16Sim::start_cycle(uint64_t ns)
+{
+  _busy_until = sim_now_ns() + ns;
+}
+void M25P16Sim::violation(void)
+{
+  stats.violations++;
+}
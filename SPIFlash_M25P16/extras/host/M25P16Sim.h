@@ -0,0 +1,139 @@
+// * Copyright (c) 2013 Shinichiro Nakamura (https://github.com/shintamainjp)
+// > Updated April. 7, 2016, George KC, Arduino version. (https://github.com/georgekc)
+// **********************************************************************************
+// License
+// **********************************************************************************
+// This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software
+// Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will
+// be useful, but WITHOUT ANY WARRANTY; without even the
+// implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public
+// License for more details.
+//
+// You should have received a copy of the GNU General
+// Public License along with this program.
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Licence can be viewed at
+// http://www.gnu.org/licenses/gpl-3.0.txt
+//
+// Please maintain this license information along with authorship
+// and copyright notices in any redistribution of this code
+
+
+#ifndef _M25P16_SIM_H_
+#define _M25P16_SIM_H_
+
+
+#include <Arduino.h>
+
+#define M25P16_SIM_ARRAY_SIZE   (2097152UL)
+#define M25P16_SIM_MAX_DEVICES  (8)
+
+/**
+   @brief Datasheet timing of the simulated device.
+   @details
+   Defaults are the typical values of the M25P16 datasheet. A PAGE PROGRAM of n bytes takes
+   tPP_base_ns + n * tPP_byte_ns, so a full page takes the typical tPP of 0.64 ms.
+*/
+typedef struct m25p16_timing {
+  uint32_t tPP_base_ns;
+  uint32_t tPP_byte_ns;
+  uint32_t tW_ns;     // WRITE STATUS REGISTER cycle
+  uint32_t tSE_us;    // SECTOR ERASE cycle
+  uint32_t tBE_us;    // BULK ERASE cycle
+  uint32_t tDP_ns;    // S# HIGH to DEEP POWER-DOWN
+  uint32_t tRES_ns;   // S# HIGH to STANDBY after RELEASE from DEEP POWER-DOWN
+  uint32_t fR_hz;     // highest clock for READ DATA BYTES
+  uint32_t fC_hz;     // highest clock for every other command
+} m25p16_timing_t;
+
+/**
+   @brief Overhead of the simulated MCU, charged to the virtual clock on top of the SPI bit time.
+*/
+typedef struct sim_host_timing {
+  uint32_t spi_call_ns;   // each SPI.transfer() call
+  uint32_t spi_byte_ns;   // each byte of a block SPI.transfer(buf, count)
+  uint32_t gpio_ns;       // each digitalWrite()
+  uint32_t syscall_ns;    // each SPI_IOC_MESSAGE ioctl of the spidev backend
+} sim_host_timing_t;
+
+/**
+   @brief Command counters of the simulated device.
+   @details
+   violations counts commands the real device would reject or mishandle: any command but
+   READ STATUS REGISTER while WIP is 1, commands sent in DEEP POWER-DOWN or before tRES has elapsed,
+   READ DATA BYTES above fR, and clocks above fC.
+*/
+typedef struct m25p16_sim_stats {
+  uint32_t selects;
+  uint32_t reads;
+  uint32_t read_bytes;
+  uint32_t programs;
+  uint32_t program_bytes;
+  uint32_t sector_erases;
+  uint32_t bulk_erases;
+  uint32_t status_reads;
+  uint32_t violations;
+} m25p16_sim_stats_t;
+
+extern sim_host_timing_t sim_host_timing;
+
+uint64_t sim_now_ns(void);
+void sim_advance_ns(uint64_t ns);
+
+/**
+   @brief Model of one M25P16 attached to a chip select pin.
+   @details
+   Covers the 2 MB array, the status register (WEL, WIP, BP2-BP0, SRWD), block protection,
+   page wrap of PAGE PROGRAM, address roll-over of reads, DEEP POWER-DOWN and the self-timed cycles,
+   which run against the virtual clock. A command is executed when S# goes HIGH after a whole number of bytes,
+   as on the device. Data of a PROGRAM or ERASE is applied at once, but the device stays busy
+   (WIP 1, other commands ignored) until the cycle time has passed.
+*/
+class M25P16Sim {
+  public:
+    M25P16Sim(uint8_t cspin);
+    ~M25P16Sim();
+    void select(void);
+    void deselect(void);
+    uint8_t transfer(uint8_t mosi, uint32_t hz);
+    bool busy(void);
+    bool deep_power_down(void);
+    void power_cycle(void);
+    uint8_t *array(void);
+    static M25P16Sim *find(uint8_t cspin);
+    static uint8_t exchange(uint8_t mosi, uint32_t hz);
+
+    m25p16_timing_t timing;
+    m25p16_sim_stats_t stats;
+    uint32_t drop_wren;     // fault injection: number of coming WRITE ENABLE commands to lose on the line
+  protected:
+    bool protected_addr(uint32_t addr);
+    uint8_t status(void);
+    void start_cycle(uint64_t ns);
+    void violation(void);
+
+    uint8_t _cspin;
+    uint8_t *_mem;
+    uint8_t _sr;            // SRWD and BP2-BP0 (non-volatile) and WEL; WIP comes from _busy_until
+    uint64_t _busy_until;
+    uint64_t _dp_at;        // time the device enters DEEP POWER-DOWN, 0 when awake
+    uint64_t _ready_at;     // end of tRES
+    bool _selected;
+    bool _ignore;           // current command is not decoded
+    uint8_t _cmd;
+    uint32_t _count;        // bytes clocked since S# went LOW
+    uint32_t _addr;
+    uint8_t _page[256];     // data latched by PAGE PROGRAM
+    uint32_t _page_n;
+    uint8_t _sr_new;
+
+};
+
+#endif
@@ -0,0 +1,85 @@
+// * Copyright (c) 2013 Shinichiro Nakamura (https://github.com/shintamainjp)
+// > Updated April. 7, 2016, George KC, Arduino version. (https://github.com/georgekc)
+// **********************************************************************************
+// License
+// **********************************************************************************
+// This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software
+// Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will
+// be useful, but WITHOUT ANY WARRANTY; without even the
+// implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public
+// License for more details.
+//
+// You should have received a copy of the GNU General
+// Public License along with this program.
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Licence can be viewed at
+// http://www.gnu.org/licenses/gpl-3.0.txt
+//
+// Please maintain this license information along with authorship
+// and copyright notices in any redistribution of this code
+
+
+#ifndef _HOST_SPI_H_
+#define _HOST_SPI_H_
+
+/// Stand-in for the Arduino SPI library used by the host (Linux) build.
+/// Bytes are exchanged with the simulated devices whose chip select is LOW,
+/// and the virtual clock advances by the time the transfer takes at the configured SPI clock.
+
+#include <Arduino.h>
+
+#define SPI_HAS_TRANSACTION (1)
+
+#define SPI_MODE0       (0x00)
+#define SPI_MODE1       (0x04)
+#define SPI_MODE2       (0x08)
+#define SPI_MODE3       (0x0C)
+
+// Same encoding as the AVR core.
+#define SPI_CLOCK_DIV4   (0x00)
+#define SPI_CLOCK_DIV16  (0x01)
+#define SPI_CLOCK_DIV64  (0x02)
+#define SPI_CLOCK_DIV128 (0x03)
+#define SPI_CLOCK_DIV2   (0x04)
+#define SPI_CLOCK_DIV8   (0x05)
+#define SPI_CLOCK_DIV32  (0x06)
+
+class SPISettings {
+  public:
+    SPISettings(uint32_t clock = 4000000, uint8_t bitOrder = MSBFIRST, uint8_t dataMode = SPI_MODE0)
+      : _clock(clock), _bitOrder(bitOrder), _dataMode(dataMode) {}
+    uint32_t _clock;
+    uint8_t _bitOrder;
+    uint8_t _dataMode;
+};
+
+class SPIClass {
+  public:
+    SPIClass(void);
+    void begin(void);
+    void end(void);
+    void beginTransaction(SPISettings settings);
+    void endTransaction(void);
+    void setBitOrder(uint8_t bitOrder);
+    void setDataMode(uint8_t dataMode);
+    void setClockDivider(uint8_t div);
+    uint8_t transfer(uint8_t data);
+    void transfer(void *buf, size_t count);
+    /// Host only: SPI clock currently in effect.
+    uint32_t clock_hz(void);
+  protected:
+    uint32_t _clockHz;
+    uint8_t _bitOrder;
+    uint8_t _dataMode;
+};
+
+extern SPIClass SPI;
+
+#endif
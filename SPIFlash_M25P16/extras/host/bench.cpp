@@ -0,0 +1,949 @@
+// * Copyright (c) 2013 Shinichiro Nakamura (https://github.com/shintamainjp)
+// > Updated April. 7, 2016, George KC,Arduino version. (https://github.com/georgekc)
+// **********************************************************************************
+// License
+// **********************************************************************************
+// This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU General
+// Public License as published by the Free Software
+// Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will
+// be useful, but WITHOUT ANY WARRANTY; without even the
+// implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE. See the GNU General Public
+// License for more details.
+//
+// You should have received a copy of the GNU General
+// Public License along with this program.
+// If not, see <http://www.gnu.org/licenses/>.
+//
+// Licence can be viewed at
+// http://www.gnu.org/licenses/gpl-3.0.txt
+//
+// Please maintain this license information along with authorship
+// and copyright notices in any redistribution of this code
+
+
+// Benchmark of the SPIFlash APIs against the simulated M25P16, on the virtual clock.
+// Every result is checked against the simulated array, and the run fails if the driver
+// sent a command the device would have rejected. Build and run with `make run`.
+
+#include <stdio.h>
+#include "SPIFlash.h"
+#include "SPIFlashAsync.h"
+#include "SPIFlashWriteBuffer.h"
+#include "SPIFlashLog.h"
+#include "SPIFlashKV.h"
+#include "SPIFlashArray.h"
+#include "SPIFlashReader.h"
+#include "SPIFlashCompressed.h"
+#include "SPIFlashScheduler.h"
+#include "M25P16Sim.h"
+#include "FakeSpidev.h"
+
+#define FLASH_CS      (8)
+#define BENCH_BYTES   (65536UL)
+#define SMALL_WRITE   (16)
+#define LOG_RECORDS   (1000)
+#define KV_SETS       (1000)
+#define ARRAY_CHIPS   (4)
+#define ARRAY_CS      (9)
+
+static M25P16Sim device(FLASH_CS);
+#ifdef ARDUINO
+static SPIFlash flash(FLASH_CS);
+#else
+static FakeSpidev bus(device);
+static SPIFlash flash(bus);
+#endif
+
+static uint8_t pattern[BENCH_BYTES];
+static uint8_t buf[BENCH_BYTES];
+static uint64_t t0;
+static int failures;
+
+static void start(void)
+{
+  t0 = sim_now_ns();
+}
+static double elapsed(void)
+{
+  return (sim_now_ns() - t0) / 1e9;
+}
+static void report_rate(const char *name, uint32_t bytes)
+{
+  printf("%-40s %12.3f MB/s\n", name, bytes / elapsed() / 1e6);
+}
+static void report_time(const char *name)
+{
+  printf("%-40s %12.3f ms\n", name, elapsed() * 1e3);
+}
+static void report_ops(const char *name, uint32_t ops)
+{
+  printf("%-40s %12.1f ops/s\n", name, ops / elapsed());
+}
+static void check(const char *name, uint32_t addr, const uint8_t *expect, uint32_t len)
+{
+  if (memcmp(device.array() + addr, expect, len) != 0) {
+    printf("FAIL: %s: array contents differ\n", name);
+    failures++;
+  }
+}
+static void erase_all(void)
+{
+  flash.flash_wait_ready();
+  flash.flash_bulk_erase();
+  flash.flash_wait_ready();
+}
+
+#ifdef ARDUINO
+// The READ DATA BYTES loop as it was before block transfers: one SPI.transfer() per byte, at fR.
+static void read_per_byte(uint32_t addr, uint8_t *data, uint32_t siz)
+{
+  uint32_t i;
+  SPI.beginTransaction(SPISettings(flash_READ_MAX_HZ, MSBFIRST, SPI_MODE0));
+  digitalWrite(FLASH_CS, LOW);
+  SPI.transfer(SPI_READ_DATA_BYTES);
+  SPI.transfer(addr >> 16);
+  SPI.transfer(addr >>  8);
+  SPI.transfer(addr >>  0);
+  for (i = 0; i < siz; i++) {
+    data[i] = SPI.transfer(0);
+  }
+  digitalWrite(FLASH_CS, HIGH);
+  SPI.endTransaction();
+}
+#endif
+
+static void bench_read(void)
+{
+  uint32_t addr;
+
+  memcpy(device.array(), pattern, BENCH_BYTES);
+
+#ifdef ARDUINO
+  start();
+  for (addr = 0; addr < BENCH_BYTES; addr += 256) {
+    read_per_byte(addr, buf + addr, 256);
+  }
+  report_rate("READ per byte (256 B, baseline)", BENCH_BYTES);
+  if (memcmp(buf, pattern, BENCH_BYTES) != 0) {
+    printf("FAIL: READ per byte: wrong data\n");
+    failures++;
+  }
+#endif
+
+  start();
+  for (addr = 0; addr < BENCH_BYTES; addr += 256) {
+    flash.flash_read_data_bytes(addr, buf + addr, 256);
+  }
+  report_rate("flash_read_data_bytes (256 B)", BENCH_BYTES);
+  if (memcmp(buf, pattern, BENCH_BYTES) != 0) {
+    printf("FAIL: flash_read_data_bytes: wrong data\n");
+    failures++;
+  }
+
+  start();
+  for (addr = 0; addr < BENCH_BYTES; addr += 4096) {
+    flash.flash_read_data_bytes(addr, buf + addr, 4096);
+  }
+  report_rate("flash_read_data_bytes (4 KB)", BENCH_BYTES);
+
+  start();
+  for (addr = 0; addr < BENCH_BYTES; addr += 256) {
+    flash.flash_fast_read_data_bytes(addr, buf + addr, 256);
+  }
+  report_rate("flash_fast_read_data_bytes (256 B)", BENCH_BYTES);
+  if (memcmp(buf, pattern, BENCH_BYTES) != 0) {
+    printf("FAIL: flash_fast_read_data_bytes: wrong data\n");
+    failures++;
+  }
+}
+
+static void bench_program(void)
+{
+  SPIFlashWriteBuffer wb(flash);
+  SPIFlashAsync async(flash);
+  uint32_t addr;
+  uint32_t programs;
+
+  erase_all();
+  start();
+  for (addr = 0; addr < BENCH_BYTES; addr += flash_PAGE_BYTE_SIZE) {
+    flash.flash_page_program(addr, pattern + addr, flash_PAGE_BYTE_SIZE);
+    flash.flash_wait_ready();
+  }
+  report_rate("flash_page_program (256 B)", BENCH_BYTES);
+  check("flash_page_program", 0, pattern, BENCH_BYTES);
+
+  erase_all();
+  start();
+  flash.flash_write(0, pattern, BENCH_BYTES);
+  report_rate("flash_write (64 KB)", BENCH_BYTES);
+  check("flash_write", 0, pattern, BENCH_BYTES);
+
+  erase_all();
+  start();
+  for (addr = 0; addr < BENCH_BYTES; addr += SMALL_WRITE) {
+    flash.flash_write(addr, pattern + addr, SMALL_WRITE);
+  }
+  report_rate("flash_write (16 B)", BENCH_BYTES);
+
+  erase_all();
+  start();
+  for (addr = 0; addr < BENCH_BYTES; addr += SMALL_WRITE) {
+    wb.write(addr, pattern + addr, SMALL_WRITE);
+  }
+  wb.flush();
+  report_rate("SPIFlashWriteBuffer (16 B)", BENCH_BYTES);
+  check("SPIFlashWriteBuffer", 0, pattern, BENCH_BYTES);
+
+  // Filled from its end: the page is programmed once, when the last gap is filled, not when byte 255 arrives.
+  erase_all();
+  programs = device.stats.programs;
+  for (addr = flash_PAGE_BYTE_SIZE; addr > 0; addr -= SMALL_WRITE) {
+    wb.write(addr - SMALL_WRITE, pattern + addr - SMALL_WRITE, SMALL_WRITE);
+  }
+  if (device.stats.programs != programs + 1) {
+    printf("FAIL: SPIFlashWriteBuffer: %lu PAGE PROGRAMs for one page\n", (unsigned long)(device.stats.programs - programs));
+    failures++;
+  }
+  check("SPIFlashWriteBuffer (backwards)", 0, pattern, flash_PAGE_BYTE_SIZE);
+
+  erase_all();
+  start();
+  async.program(0, pattern, BENCH_BYTES);
+  while (async.poll()) {
+  }
+  report_rate("SPIFlashAsync::program (64 KB)", BENCH_BYTES);
+  check("SPIFlashAsync::program", 0, pattern, BENCH_BYTES);
+
+  // queued while an erase the caller started is still running: must wait for it, not be dropped
+  flash.flash_sector_erase(flash_SECTOR_BYTE_SIZE);
+  async.program(flash_SECTOR_BYTE_SIZE, pattern, flash_PAGE_BYTE_SIZE);
+  while (async.poll()) {
+  }
+  check("SPIFlashAsync::program behind an erase", flash_SECTOR_BYTE_SIZE, pattern, flash_PAGE_BYTE_SIZE);
+}
+
+static void bench_erase(void)
+{
+  flash.flash_wait_ready();
+  start();
+  flash.flash_sector_erase(0);
+  flash.flash_wait_ready();
+  report_time("flash_sector_erase");
+
+  start();
+  flash.flash_bulk_erase();
+  flash.flash_wait_ready();
+  report_time("flash_bulk_erase");
+}
+
+static void bench_smart_write(void)
+{
+  const uint32_t base = 2 * flash_SECTOR_BYTE_SIZE;
+  const uint32_t addr = base + 0x1000;
+  uint32_t i;
+
+  erase_all();
+  flash.flash_write(base, pattern, BENCH_BYTES);
+  memcpy(buf, pattern, BENCH_BYTES);
+
+  start();
+  flash.flash_smart_write(addr, buf + 0x1000, 256, 3 * flash_SECTOR_BYTE_SIZE);
+  report_time("flash_smart_write (256 B, unchanged)");
+
+  for (i = 0; i < 256; i++) {
+    buf[0x1000 + i] &= 0xF0;
+  }
+  start();
+  flash.flash_smart_write(addr, buf + 0x1000, 256, 3 * flash_SECTOR_BYTE_SIZE);
+  report_time("flash_smart_write (256 B, 1 to 0)");
+  check("flash_smart_write (1 to 0)", base, buf, BENCH_BYTES);
+
+  for (i = 0; i < 256; i++) {
+    buf[0x1000 + i] = ~buf[0x1000 + i];
+  }
+  start();
+  flash.flash_smart_write(addr, buf + 0x1000, 256, 3 * flash_SECTOR_BYTE_SIZE);
+  report_time("flash_smart_write (256 B, erase)");
+  check("flash_smart_write (erase)", base, buf, BENCH_BYTES);
+}
+
+static void bench_crc(void)
+{
+  static const uint8_t check_value[] = "123456789";
+  uint32_t crc;
+
+  if (flash_crc32_update(0, check_value, 9) != 0xCBF43926UL ||
+      flash_crc32_update(flash_crc32_update(0, check_value, 4), check_value + 4, 5) != 0xCBF43926UL) {
+    printf("FAIL: flash_crc32_update: wrong check value\n");
+    failures++;
+  }
+
+  erase_all();
+  start();
+  crc = flash.flash_write_crc(0, pattern, BENCH_BYTES);
+  report_rate("flash_write_crc (64 KB)", BENCH_BYTES);
+  if (crc != flash_crc32_update(0, pattern, BENCH_BYTES)) {
+    printf("FAIL: flash_write_crc: wrong CRC\n");
+    failures++;
+  }
+
+  start();
+  if (!flash.flash_verify(0, crc, BENCH_BYTES)) {
+    printf("FAIL: flash_verify: mismatch\n");
+    failures++;
+  }
+  report_rate("flash_verify (64 KB)", BENCH_BYTES);
+
+  start();
+  flash.flash_read_data_bytes(0, buf, BENCH_BYTES);
+  if (memcmp(buf, pattern, BENCH_BYTES) != 0) {
+    printf("FAIL: read back: wrong data\n");
+    failures++;
+  }
+  report_rate("read back + memcmp (64 KB)", BENCH_BYTES);
+
+  device.array()[BENCH_BYTES / 2] ^= 0x01;
+  if (flash.flash_verify(0, crc, BENCH_BYTES)) {
+    printf("FAIL: flash_verify: missed a flipped bit\n");
+    failures++;
+  }
+}
+
+static void bench_reader(void)
+{
+  SPIFlashReader reader(flash, 0x1000, BENCH_BYTES - 0x1000);
+  const uint32_t len = BENCH_BYTES - 0x1000;
+  uint32_t i;
+  int c;
+
+  memcpy(device.array(), pattern, BENCH_BYTES);
+  flash.flash_cache_invalidate();
+
+  start();
+  for (i = 0; i < len; i += SPIFLASH_READER_BLOCK) {
+    flash.flash_read_data_bytes(0x1000 + i, buf + i, SPIFLASH_READER_BLOCK);
+  }
+  report_rate("flash_read_data_bytes (64 B)", len);
+
+  start();
+  for (i = 0; (c = reader.read()) >= 0; i++) {
+    buf[i] = c;
+  }
+  report_rate("SPIFlashReader::read() (1 B)", len);
+  if (i != len || memcmp(buf, pattern + 0x1000, len) != 0) {
+    printf("FAIL: SPIFlashReader::read(): wrong data\n");
+    failures++;
+  }
+
+  reader.seek(0);
+  memset(buf, 0, len);
+  start();
+  for (i = 0; i < len; i += 16) {
+    reader.read(buf + i, 16);
+    reader.poll();
+  }
+  report_rate("SPIFlashReader::read (16 B) + poll", len);
+  if (memcmp(buf, pattern + 0x1000, len) != 0) {
+    printf("FAIL: SPIFlashReader::read (16 B): wrong data\n");
+    failures++;
+  }
+
+  if (!reader.seek(100) || reader.read() != pattern[0x1000 + 100] || reader.position() != 101 ||
+      !reader.seek(40000) || reader.peek() != pattern[0x1000 + 40000] ||
+      !reader.seek(90) || reader.read(buf, 300) != 300 || memcmp(buf, pattern + 0x1000 + 90, 300) != 0 ||
+      reader.seek(len + 1) || !reader.seek(len - 1) || reader.read(buf, 10) != 1 || reader.read() != -1) {
+    printf("FAIL: SPIFlashReader::seek: wrong data\n");
+    failures++;
+  }
+
+  // Another command in between ends the open READ; the reader starts a new one.
+  reader.seek(0);
+  reader.read(buf, 100);
+  flash.flash_busy();
+  if (reader.read(buf + 100, 200) != 200 || memcmp(buf, pattern + 0x1000, 300) != 0) {
+    printf("FAIL: SPIFlashReader: wrong data after another command\n");
+    failures++;
+  }
+  reader.end();
+}
+
+#if SPIFLASH_CACHE_PAGES > 0
+static void bench_cache(void)
+{
+  flash_cache_stats_t st;
+  uint32_t violations;
+
+  erase_all();
+  memcpy(device.array(), pattern, 2 * flash_PAGE_BYTE_SIZE);
+  flash.flash_cache_invalidate();
+  flash.flash_cache_reset_stats();
+  flash.flash_read_data_bytes(0, buf, flash_PAGE_BYTE_SIZE);
+  flash.flash_read_data_bytes(16, buf, 16);
+  flash.flash_cache_get_stats(&st);
+  if (st.misses != 1 || st.hits != 1 || memcmp(buf, pattern + 16, 16) != 0) {
+    printf("FAIL: page cache: %lu hits, %lu misses\n", (unsigned long)st.hits, (unsigned long)st.misses);
+    failures++;
+  }
+
+  flash.flash_sector_erase(0);
+  flash.flash_wait_ready();
+  flash.flash_read_data_bytes(0, buf, 16);
+  if (buf[0] != 0xFF || buf[15] != 0xFF) {
+    printf("FAIL: page cache: stale page after SECTOR ERASE\n");
+    failures++;
+  }
+
+  // A read during the PAGE PROGRAM is refused by the device; what it returns must not be cached.
+  flash.flash_page_program(0, pattern, flash_PAGE_BYTE_SIZE);
+  violations = device.stats.violations;
+  flash.flash_read_data_bytes(0, buf, 16);
+  device.stats.violations = violations;
+  flash.flash_wait_ready();
+  flash.flash_read_data_bytes(0, buf, 16);
+  if (memcmp(buf, pattern, 16) != 0) {
+    printf("FAIL: page cache: stale page after PAGE PROGRAM\n");
+    failures++;
+  }
+  flash.flash_cache_get_stats(&st);
+  if (st.misses != 4 || st.hits != 1) {
+    printf("FAIL: page cache: %lu hits, %lu misses\n", (unsigned long)st.hits, (unsigned long)st.misses);
+    failures++;
+  }
+}
+#endif
+
+static void bench_power(void)
+{
+  uint32_t selects;
+
+  memcpy(device.array(), pattern, BENCH_BYTES);
+  flash.flash_cache_invalidate();
+  flash.flash_wait_ready();
+
+  start();
+  flash.flash_read_data_bytes(0, buf, 256);
+  report_time("read 256 B (standby)");
+
+  flash.flash_set_auto_power_down(1000);
+  sim_advance_ns(500000);
+  if (flash.flash_idle()) {
+    printf("FAIL: flash_idle: powered down before the idle time\n");
+    failures++;
+  }
+  sim_advance_ns(1000000);
+  if (!flash.flash_idle()) {
+    printf("FAIL: flash_idle: did not power down\n");
+    failures++;
+  }
+  sim_advance_ns(10000);
+  if (!device.deep_power_down() || flash.flash_busy()) {
+    printf("FAIL: flash_idle: device not in deep power-down\n");
+    failures++;
+  }
+
+  memset(buf, 0, 256);
+  flash.flash_cache_invalidate();  // a cache hit would not wake the device
+  start();
+  flash.flash_read_data_bytes(0, buf, 256);
+  report_time("read 256 B (lazy wake)");
+  if (device.deep_power_down() || memcmp(buf, pattern, 256) != 0) {
+    printf("FAIL: wake on read: wrong data\n");
+    failures++;
+  }
+
+  flash.flash_deep_power_down();
+  sim_advance_ns(10000);
+  flash.flash_release_from_deep_power_down();
+  sim_advance_ns(50000);  // other work while tRES elapses
+  start();
+  flash.flash_read_data_bytes(256, buf, 256);
+  report_time("read 256 B (early wake)");
+  if (memcmp(buf, pattern + 256, 256) != 0) {
+    printf("FAIL: early wake: wrong data\n");
+    failures++;
+  }
+
+  selects = device.stats.selects;
+  flash.flash_release_from_deep_power_down();  // already awake: nothing to send, no tRES to wait
+  if (device.stats.selects != selects) {
+    printf("FAIL: flash_release_from_deep_power_down: command sent in STANDBY\n");
+    failures++;
+  }
+  flash.flash_set_auto_power_down(0);
+}
+
+static void bench_log(void)
+{
+  SPIFlashLog log(flash, 4, 4);
+  SPIFlashLog one(flash, 8, 1);
+  flash_log_cursor_t cursor;
+  uint8_t rec[32];
+  uint16_t i;
+  uint16_t n = 0;
+
+  erase_all();
+  log.format();
+  start();
+  for (i = 0; i < LOG_RECORDS; i++) {
+    log.append(pattern + i, 32);
+  }
+  report_ops("SPIFlashLog::append (32 B)", LOG_RECORDS);
+
+  log.rewind(&cursor);
+  while (log.next(&cursor, rec, sizeof(rec)) == 32 && n < LOG_RECORDS) {
+    n++;
+  }
+  if (n == 0 || memcmp(rec, pattern + LOG_RECORDS - 1, 32) != 0) {
+    printf("FAIL: SPIFlashLog: wrong records read back\n");
+    failures++;
+  }
+
+  one.format();
+  if (one.mount() || one.append(pattern, 32) || device.array()[8 * flash_SECTOR_BYTE_SIZE] != 0xFF) {
+    printf("FAIL: SPIFlashLog: a one-sector ring was accepted\n");
+    failures++;
+  }
+}
+
+static void bench_kv(void)
+{
+  SPIFlashKV kv(flash, 8, 4);
+  SPIFlashKV two(flash, 30, 2);
+  uint16_t i;
+  uint8_t value[8];
+
+  erase_all();
+  kv.format();
+  start();
+  for (i = 0; i < KV_SETS; i++) {
+    memcpy(value, pattern + i, sizeof(value));
+    kv.set(i % 64, value, sizeof(value));
+  }
+  report_ops("SPIFlashKV::set (8 B)", KV_SETS);
+  if (kv.get((KV_SETS - 1) % 64, buf, sizeof(value)) != sizeof(value) || memcmp(buf, value, sizeof(value)) != 0) {
+    printf("FAIL: SPIFlashKV::get: wrong value\n");
+    failures++;
+  }
+
+  two.format();
+  if (two.mount() || two.set(1, value, sizeof(value)) || device.array()[30 * flash_SECTOR_BYTE_SIZE] != 0xFF) {
+    printf("FAIL: SPIFlashKV: a two-sector store was accepted\n");
+    failures++;
+  }
+}
+
+static void bench_erase_ahead(void)
+{
+  const uint8_t map_sector = flash_SECTOR_COUNT - 1;
+  const uint8_t first = 4;
+  int8_t sector;
+  uint8_t i;
+  uint32_t rounds = 0;
+
+  erase_all();
+  for (i = first; i < first + 4; i++) {
+    flash.flash_write((uint32_t)i * flash_SECTOR_BYTE_SIZE, pattern, BENCH_BYTES);
+  }
+
+  start();
+  flash.flash_sector_erase((uint32_t)first * flash_SECTOR_BYTE_SIZE);
+  flash.flash_wait_ready();
+  flash.flash_write((uint32_t)first * flash_SECTOR_BYTE_SIZE, pattern, BENCH_BYTES);
+  report_rate("erase + flash_write (64 KB)", BENCH_BYTES);
+
+  if (flash.flash_map_mount(map_sector)) {
+    printf("FAIL: flash_map_mount: found a map in a blank sector\n");
+    failures++;
+  }
+  for (i = first; i < first + 4; i++) {
+    flash.flash_sector_free(i);
+  }
+  flash.flash_set_erase_ahead(true);
+  while (flash.flash_idle() == false && rounds < 100000) {
+    sim_advance_ns(1000000);  // idle time of the application
+    rounds++;
+    if (flash.flash_sector_is_erased(first + 3) && !flash.flash_busy()) {
+      flash.flash_idle();  // saves the map
+      break;
+    }
+  }
+
+  sector = flash.flash_find_erased_sector();
+  start();
+  flash.flash_write((uint32_t)sector * flash_SECTOR_BYTE_SIZE, pattern, BENCH_BYTES);
+  report_rate("flash_write to an erased sector (64 KB)", BENCH_BYTES);
+  check("flash_write to an erased sector", (uint32_t)sector * flash_SECTOR_BYTE_SIZE, pattern, BENCH_BYTES);
+
+  start();
+  flash.flash_map_mount(map_sector);
+  report_time("flash_map_mount");
+  for (i = first; i < first + 4; i++) {
+    if (flash.flash_sector_is_erased(i) != (i != sector) ||
+        (i != sector && device.array()[(uint32_t)i * flash_SECTOR_BYTE_SIZE + 0x1234] != 0xFF)) {
+      printf("FAIL: erased-sector map: wrong state of sector %u\n", i);
+      failures++;
+    }
+  }
+
+  // Erases the device ignores must not reach the map: one whose WRITE ENABLE is lost, one on a protected sector.
+  device.drop_wren = 1;
+  flash.flash_sector_erase((uint32_t)sector * flash_SECTOR_BYTE_SIZE);
+  flash.flash_wait_ready();
+  flash.flash_write_enable();
+  flash.flash_write_status_register(2 << 2);  // BP = 2: sectors 30 and 31
+  flash.flash_wait_ready();
+  flash.flash_write((uint32_t)(flash_SECTOR_COUNT - 2) * flash_SECTOR_BYTE_SIZE, pattern, 256);
+  flash.flash_sector_erase((uint32_t)(flash_SECTOR_COUNT - 2) * flash_SECTOR_BYTE_SIZE);
+  flash.flash_wait_ready();
+  flash.flash_write_enable();
+  flash.flash_write_status_register(0);
+  flash.flash_wait_ready();
+  if (flash.flash_sector_is_erased(sector) || flash.flash_sector_is_erased(flash_SECTOR_COUNT - 2)) {
+    printf("FAIL: erased-sector map: an ignored SECTOR ERASE marked its sector erased\n");
+    failures++;
+  }
+  flash.flash_set_erase_ahead(false);
+  flash.flash_map_mount(flash_SECTOR_COUNT);
+}
+
+static void lz_sink(void *ctx, const uint8_t *data, uint32_t len)
+{
+  uint8_t **p = (uint8_t **)ctx;
+  memcpy(*p, data, len);
+  *p += len;
+}
+static int16_t lz_source(void *ctx)
+{
+  const uint8_t **p = (const uint8_t **)ctx;
+  return *(*p)++;
+}
+
+static void bench_compressed(void)
+{
+  static uint8_t sensor[BENCH_BYTES];
+  static uint8_t packed[FLASH_LZ_BOUND(BENCH_BYTES)];
+  uint8_t window[FLASH_LZ_WINDOW];
+  SPIFlashCompressed store(flash, 16, 8);
+  uint8_t *out;
+  const uint8_t *in;
+  uint32_t n;
+  uint32_t i;
+
+  // 16-byte records of slowly changing readings.
+  for (i = 0; i < BENCH_BYTES / 16; i++) {
+    uint8_t *r = &sensor[i * 16];
+    uint32_t ts = i * 1000;
+    uint16_t temp = 2150 + (i / 64) % 40 + (rand() & 1);
+    uint16_t hum = 4800 + (i / 128) % 25;
+    memset(r, 0, 16);
+    memcpy(r, &ts, 4);
+    r[4] = i % 4;
+    memcpy(r + 6, &temp, 2);
+    memcpy(r + 8, &hum, 2);
+  }
+
+  out = packed;
+  n = flash_lz_compress(pattern, 4096, lz_sink, &out);
+  in = packed;
+  if (n > FLASH_LZ_BOUND(4096) || flash_lz_decompress(lz_source, &in, window, 0, buf, 4096) != 4096 ||
+      memcmp(buf, pattern, 4096) != 0) {
+    printf("FAIL: flash_lz: random data does not round-trip\n");
+    failures++;
+  }
+  out = packed;
+  n = flash_lz_compress(sensor, BENCH_BYTES / 2, lz_sink, &out);
+  in = packed;
+  if (flash_lz_decompress(lz_source, &in, window, 1000, buf, 3000) != 3000 || memcmp(buf, sensor + 1000, 3000) != 0) {
+    printf("FAIL: flash_lz: sensor data does not round-trip\n");
+    failures++;
+  }
+
+  erase_all();
+  start();
+  for (i = 0; i < BENCH_BYTES; i += 64) {
+    flash.flash_write((uint32_t)16 * flash_SECTOR_BYTE_SIZE + i, sensor + i, 64);
+  }
+  report_rate("flash_write sensor data (64 B)", BENCH_BYTES);
+
+  store.format();
+  start();
+  for (i = 0; i < BENCH_BYTES; i += 64) {
+    store.write(sensor + i, 64);
+  }
+  store.flush();
+  report_rate("SPIFlashCompressed::write (64 B)", BENCH_BYTES);
+  printf("%-40s %12.2f\n", "SPIFlashCompressed ratio", (double)store.size() / store.stored());
+
+  memset(buf, 0, BENCH_BYTES);
+  start();
+  n = store.read(0, buf, BENCH_BYTES);
+  report_rate("SPIFlashCompressed::read (64 KB)", BENCH_BYTES);
+  if (n != BENCH_BYTES || memcmp(buf, sensor, BENCH_BYTES) != 0) {
+    printf("FAIL: SPIFlashCompressed::read: wrong data\n");
+    failures++;
+  }
+  if (store.read(12345, buf, 5000) != 5000 || memcmp(buf, sensor + 12345, 5000) != 0 ||
+      store.read(BENCH_BYTES - 10, buf, 100) != 10) {
+    printf("FAIL: SPIFlashCompressed::read: wrong data at an offset\n");
+    failures++;
+  }
+
+  // Data compressed but not flushed, as after a power loss in the middle of write(): blocks whose index entry
+  // was not written are skipped at mount.
+  store.write(sensor, 2 * SPIFLASH_LZ_BLOCK);
+  {
+    SPIFlashCompressed again(flash, 16, 8);
+    uint32_t base;
+    if (!again.mount() || again.size() < BENCH_BYTES || again.size() > BENCH_BYTES + 2 * SPIFLASH_LZ_BLOCK) {
+      printf("FAIL: SPIFlashCompressed::mount: wrong size\n");
+      failures++;
+    }
+    base = again.size();
+    again.write(pattern, 5000);
+    again.flush();
+    if (again.read(BENCH_BYTES - 100, buf, base - BENCH_BYTES + 5100) != base - BENCH_BYTES + 5100 ||
+        memcmp(buf, sensor + BENCH_BYTES - 100, 100) != 0 ||
+        memcmp(buf + 100, sensor, base - BENCH_BYTES) != 0 ||
+        memcmp(buf + 100 + base - BENCH_BYTES, pattern, 5000) != 0) {
+      printf("FAIL: SPIFlashCompressed: wrong data after remount\n");
+      failures++;
+    }
+  }  {
+    SPIFlashCompressed none(flash, 16, 0);
+    SPIFlashCompressed past(flash, 28, 8);  // would run past the last sector
+    uint32_t erases = device.stats.sector_erases;
+    none.format();
+    past.format();
+    if (none.mount() || none.write(pattern, 100) || past.mount() || past.write(pattern, 100) ||
+        device.stats.sector_erases != erases) {
+      printf("FAIL: SPIFlashCompressed: an invalid region was accepted\n");
+      failures++;
+    }
+  }
+}
+
+static void bench_scheduler(void)
+{
+  SPIFlashScheduler sched(flash);
+  const uint32_t batch = 4 * flash_SECTOR_BYTE_SIZE;
+  const uint32_t hot = 8 * flash_SECTOR_BYTE_SIZE;
+  flash_sched_stats_t st;
+  flash_handle_t h = FLASH_HANDLE_NONE;
+  uint8_t rd[256];
+  uint32_t off = 0, ticks = 0, reads = 0, i;
+
+  flash.flash_wait_ready();
+  for (i = 0; i < batch; i += BENCH_BYTES) {
+    memcpy(device.array() + i, pattern, BENCH_BYTES);
+  }
+  memcpy(device.array() + hot, pattern, BENCH_BYTES);
+  flash.flash_cache_invalidate();
+
+  start();
+  sched.erase(0, batch);
+  sched.program(0, pattern, BENCH_BYTES);
+  sched.read(0x1000, rd, sizeof(rd), FLASH_SCHED_URGENT);
+  sched.get_stats(FLASH_SCHED_URGENT, &st);
+  if (st.buffered != 1 || memcmp(rd, pattern + 0x1000, sizeof(rd)) != 0) {
+    printf("FAIL: SPIFlashScheduler: read not answered from the queued program\n");
+    failures++;
+  }
+  while (sched.poll()) {
+    sim_advance_ns(100000);  // other work of the application
+    if (h != FLASH_HANDLE_NONE && !sched.pending(h)) {
+      if (memcmp(rd, pattern + off, sizeof(rd)) != 0) {
+        printf("FAIL: SPIFlashScheduler: wrong data at %lu\n", (unsigned long)off);
+        failures++;
+      }
+      h = FLASH_HANDLE_NONE;
+    }
+    if (h == FLASH_HANDLE_NONE && ++ticks % 50 == 0) {  // a latency-critical read every 5 ms
+      off = (reads++ * sizeof(rd)) % BENCH_BYTES;
+      h = sched.read(hot + off, rd, sizeof(rd), FLASH_SCHED_URGENT, 700000);
+    }
+  }
+  report_time("SPIFlashScheduler erase + program");
+  check("SPIFlashScheduler", 0, pattern, BENCH_BYTES);
+  for (i = BENCH_BYTES; i < batch; i++) {
+    if (device.array()[i] != 0xFF) {
+      printf("FAIL: SPIFlashScheduler: sector %lu not erased\n", (unsigned long)(i / flash_SECTOR_BYTE_SIZE));
+      failures++;
+      break;
+    }
+  }
+  sched.get_stats(FLASH_SCHED_URGENT, &st);
+  printf("%-40s %12lu\n", "urgent reads during the batch", (unsigned long)st.completed);
+  printf("%-40s %12.3f ms\n", "urgent read average latency", st.total_us / 1e3 / st.completed);
+  printf("%-40s %12.3f ms\n", "urgent read max latency", st.max_us / 1e3);
+  if (st.missed != 0) {
+    printf("FAIL: SPIFlashScheduler: %lu urgent reads missed their deadline\n", (unsigned long)st.missed);
+    failures++;
+  }
+}
+
+static void count_done(flash_handle_t handle, void *ctx)
+{
+  (void)handle;
+  (*(uint8_t *)ctx)++;
+}
+
+// Programs and erases of a protected area are refused by the device: the queues must report them as failed.
+static void bench_refused(void)
+{
+  SPIFlashAsync async(flash);
+  SPIFlashScheduler sched(flash);
+  const uint32_t prot = (uint32_t)(flash_SECTOR_COUNT - 2) * flash_SECTOR_BYTE_SIZE;  // BP = 2: sectors 30 and 31
+  flash_sched_stats_t st;
+  uint8_t done = 0;
+
+  flash.flash_wait_ready();
+  flash.flash_write_enable();
+  flash.flash_write_status_register(2 << 2);
+  flash.flash_wait_ready();
+
+  async.sector_erase(prot, count_done, &done);
+  async.program(prot + 100, pattern, 1000, count_done, &done);
+  async.sector_erase(0, count_done, &done);
+  while (async.poll()) {
+  }
+  if (async.failed() != 2 || done != 3) {
+    printf("FAIL: SPIFlashAsync: %u refused operations reported, %u callbacks\n", async.failed(), done);
+    failures++;
+  }
+
+  sched.erase(prot, flash_SECTOR_BYTE_SIZE, FLASH_SCHED_NORMAL);
+  sched.program(prot + 100, pattern, 1000, FLASH_SCHED_NORMAL);
+  sched.erase(0, flash_SECTOR_BYTE_SIZE, FLASH_SCHED_NORMAL);
+  while (sched.poll()) {
+  }
+  sched.get_stats(FLASH_SCHED_NORMAL, &st);
+  if (st.failed != 2 || st.completed != 1) {
+    printf("FAIL: SPIFlashScheduler: %lu failed, %lu completed\n", (unsigned long)st.failed, (unsigned long)st.completed);
+    failures++;
+  }
+
+  flash.flash_write_enable();
+  flash.flash_write_status_register(0);
+  flash.flash_wait_ready();
+}
+
+static void bench_array(void)
+{
+  M25P16Sim *sims[ARRAY_CHIPS];
+  SPIFlash *chips[ARRAY_CHIPS];
+#ifndef ARDUINO
+  FakeSpidev *buses[ARRAY_CHIPS];
+#endif
+  uint8_t i;
+
+  for (i = 0; i < ARRAY_CHIPS; i++) {
+    sims[i] = new M25P16Sim(ARRAY_CS + i);
+#ifdef ARDUINO
+    chips[i] = new SPIFlash(ARRAY_CS + i);
+#else
+    buses[i] = new FakeSpidev(*sims[i]);
+    chips[i] = new SPIFlash(*buses[i]);
+#endif
+  }
+  {
+    SPIFlashArray array(chips, ARRAY_CHIPS);
+
+    start();
+    array.write(0, pattern, BENCH_BYTES);
+    report_rate("SPIFlashArray::write (4 chips, 64 KB)", BENCH_BYTES);
+    start();
+    array.read(0, buf, BENCH_BYTES);
+    report_rate("SPIFlashArray::read (4 chips, 64 KB)", BENCH_BYTES);
+    if (memcmp(buf, pattern, BENCH_BYTES) != 0) {
+      printf("FAIL: SPIFlashArray: wrong data\n");
+      failures++;
+    }
+    start();
+    array.erase_sector(0);
+    report_time("SPIFlashArray::erase_sector (4 chips)");
+
+    array.write(1000, pattern, 5000);  // starts and ends inside a page
+    array.read(1000, buf, 5000);
+    if (memcmp(buf, pattern, 5000) != 0) {
+      printf("FAIL: SPIFlashArray: wrong data of an unaligned write\n");
+      failures++;
+    }
+    array.erase_sector(0);
+  }
+  {
+    SPIFlashArray none(NULL, ARRAY_CHIPS);
+
+    none.write(0, pattern, flash_PAGE_BYTE_SIZE);
+    none.read(0, buf, flash_PAGE_BYTE_SIZE);
+    if (none.size() != 0) {
+      printf("FAIL: SPIFlashArray: an array without devices has a size\n");
+      failures++;
+    }
+  }
+  for (i = 0; i < ARRAY_CHIPS; i++) {
+    if (sims[i]->stats.violations != 0) {
+      printf("FAIL: SPIFlashArray: %lu protocol violations on chip %u\n",
+             (unsigned long)sims[i]->stats.violations, i);
+      failures++;
+    }
+    delete chips[i];
+#ifndef ARDUINO
+    delete buses[i];
+#endif
+    delete sims[i];
+  }
+}
+
+int main(void)
+{
+  uint32_t i;
+
+  srand(1);
+  for (i = 0; i < BENCH_BYTES; i++) {
+    pattern[i] = rand();
+  }
+#ifdef ARDUINO
+  printf("M25P16 simulator, Arduino SPI at %lu Hz\n", (unsigned long)SPI.clock_hz());
+#else
+  printf("M25P16 simulator, spidev at %lu Hz\n", (unsigned long)bus.clock_hz());
+  SPIFlashSpidev missing("/nonexistent/spidev0.0");
+  SPIFlash absent(missing);
+  if (absent.flash_bus_ok() || !flash.flash_bus_ok()) {
+    printf("FAIL: flash_bus_ok: the result of begin() is lost\n");
+    failures++;
+  }
+#endif
+  bench_read();
+  bench_program();
+  bench_erase();
+  bench_smart_write();
+  bench_crc();
+  bench_reader();
+#if SPIFLASH_CACHE_PAGES > 0
+  bench_cache();
+#endif
+  bench_power();
+  bench_log();
+  bench_kv();
+  bench_erase_ahead();
+  bench_compressed();
+  bench_scheduler();
+  bench_refused();
+  bench_array();
+#ifdef ARDUINO
+  fflush(stdout);
+  flash.flash_stats_dump(Serial);
+  flash.flash_trace_dump(Serial);
+#else
+  printf("%-40s %12lu\n", "SPI_IOC_MESSAGE ioctls", (unsigned long)bus.messages());
+#endif
+  printf("%-40s %12lu\n", "CS assertions", (unsigned long)device.stats.selects);
+  printf("%-40s %12lu\n", "protocol violations", (unsigned long)device.stats.violations);
+  return (failures != 0 || device.stats.violations != 0) ? 1 : 0;
+}